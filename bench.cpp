@@ -0,0 +1,515 @@
+#include "board.hpp"
+#include "simulation.hpp"
+#include "search.hpp"
+#include "fenwick.hpp"
+#include "read_data.hpp"
+#include "distance_map.hpp"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <thread>
+#include <array>
+#include <deque>
+#include <atomic>
+#include <new>
+
+using namespace std;
+
+const uint8_t MAP_WIDTH = 33;
+
+uint64_t sink = 0;
+
+// Every allocation made through new, so that the rollout can be checked
+// not to allocate.
+atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+    allocations++;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+template <typename F>
+double nanoseconds_per_call(uint64_t calls, F f) {
+    auto start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < calls; i++) f(i);
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / calls;
+}
+
+uint16_t linear_sample(const uint32_t* weights, uint16_t size, uint32_t target) {
+    uint16_t index = 0;
+    while (index < size - 1 && weights[index] <= target) target -= weights[index++];
+    return index;
+}
+
+// Vose's alias method, O(1) to sample but O(n) to rebuild after a change.
+struct alias_table {
+
+    explicit alias_table(uint16_t size) : probability(size), alias(size) {}
+
+    vector<double> probability;
+    vector<uint16_t> alias;
+    vector<uint16_t> small, large;
+    vector<double> scaled;
+
+    void build(const uint32_t* weights, uint32_t total) {
+        uint16_t size = probability.size();
+        small.clear();
+        large.clear();
+        scaled.resize(size);
+        for (uint16_t i = 0; i < size; i++) {
+            scaled[i] = (double)weights[i] * size / total;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            uint16_t s = small.back(), l = large.back();
+            small.pop_back();
+            probability[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] -= 1 - scaled[s];
+            if (scaled[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        for (uint16_t i : large) probability[i] = 1;
+        for (uint16_t i : small) probability[i] = 1;
+    }
+
+    uint16_t sample(uint32_t random_bytes) {
+        uint16_t column = random_bytes % probability.size();
+        return (random_bytes >> 16) * (1.0 / 65536) < probability[column] ? column : alias[column];
+    }
+};
+
+// Samples and then rewards the sampled action, as a tree node does, over
+// the 65 * 6 branching factor from planning.org.
+void sampling_comparison() {
+    const uint16_t size = 65 * 6;
+    const uint64_t calls = 1000000;
+    mt19937 mt(3);
+    uint32_t weights[size];
+    bot_allocator a(1 << 16);
+    fenwick f(size, a);
+    uint32_t total = 0;
+    for (uint16_t i = 0; i < size; i++) {
+        weights[i] = 1 + mt() % 20;
+        total += weights[i];
+        f.update(i, weights[i]);
+    }
+    alias_table table(size);
+    table.build(weights, total);
+    vector<uint32_t> randoms(calls);
+    for (auto& r : randoms) r = mt();
+
+    cout << "sampling from " << size << " weights (ns per call)" << endl;
+    cout << "            sample   sample+update" << endl;
+    double fenwick_sample = nanoseconds_per_call(calls, [&](uint64_t i) {
+        sink += f.find_index(randoms[i] % f.total);
+    });
+    double fenwick_update = nanoseconds_per_call(calls, [&](uint64_t i) {
+        uint16_t index = f.find_index(randoms[i] % f.total);
+        f.update(index, 1);
+        sink += index;
+    });
+    double linear_sample_time = nanoseconds_per_call(calls, [&](uint64_t i) {
+        sink += linear_sample(weights, size, randoms[i] % total);
+    });
+    double linear_update = nanoseconds_per_call(calls, [&](uint64_t i) {
+        uint16_t index = linear_sample(weights, size, randoms[i] % total);
+        weights[index]++;
+        total++;
+        sink += index;
+    });
+    double alias_sample = nanoseconds_per_call(calls, [&](uint64_t i) {
+        sink += table.sample(randoms[i]);
+    });
+    double alias_update = nanoseconds_per_call(calls / 100, [&](uint64_t i) {
+        uint16_t index = table.sample(randoms[i]);
+        weights[index]++;
+        total++;
+        table.build(weights, total);
+        sink += index;
+    });
+    cout << fixed << setprecision(1)
+         << "fenwick " << setw(10) << fenwick_sample << setw(16) << fenwick_update << endl
+         << "linear  " << setw(10) << linear_sample_time << setw(16) << linear_update << endl
+         << "alias   " << setw(10) << alias_sample << setw(16) << alias_update << endl;
+}
+
+// A round map with deep space outside the circle, dirt scattered over the
+// inside and the two teams facing each other.
+board<MAP_WIDTH> generate_board(uint32_t seed) {
+    mt19937 mt(seed);
+    vector<vector<cell>> map(MAP_WIDTH);
+    int centre = MAP_WIDTH / 2;
+    for (int y = 0; y < MAP_WIDTH; y++) {
+        for (int x = 0; x < MAP_WIDTH; x++) {
+            int dx = x - centre, dy = y - centre;
+            string type = "AIR";
+            if (dx * dx + dy * dy > centre * centre) type = "DEEP_SPACE";
+            else if (mt() % 100 < 40) type = "DIRT";
+            map[y].push_back({ x, y, type });
+        }
+    }
+    vector<my_worm> mine;
+    vector<worm> yours;
+    for (int i = 0; i < 3; i++) {
+        int x = 10 + 6 * i;
+        map[8][x].type = "AIR";
+        map[24][x].type = "AIR";
+        mine.push_back({ i + 1, 150, { x, 24 }, 1, 1, { 8, 4 } });
+        yours.push_back({ i + 1, 150, { x, 8 }, 1, 1 });
+    }
+    return board<MAP_WIDTH>(map, mine, yours);
+}
+
+// Range checks the way the board used to do them, for comparison.
+bool sqrt_in_range(position one, position other, uint8_t range) {
+    int16_t dx = one.x - other.x, dy = one.y - other.y;
+    return sqrt(dx * dx + dy * dy) <= range + sqrt(2);
+}
+
+void shooting_throughput(board<MAP_WIDTH> b) {
+    const uint64_t calls = 1000000;
+    const uint16_t layouts = 1024;
+    mt19937 mt(5);
+    b.range = 4;
+    vector<array<position, 4>> positions(layouts);
+    for (auto& layout : positions) {
+        for (auto& p : layout) {
+            p = position(10 + mt() % 13, 10 + mt() % 13);
+        }
+    }
+    cout << "range checks and shoot candidates (ns per call)" << endl;
+    double sqrt_time = nanoseconds_per_call(calls, [&](uint64_t i) {
+        const auto& layout = positions[i % layouts];
+        sink += sqrt_in_range(layout[0], layout[i & 3], b.range);
+    });
+    double squared_time = nanoseconds_per_call(calls, [&](uint64_t i) {
+        const auto& layout = positions[i % layouts];
+        sink += b.in_range(layout[0], layout[i & 3]);
+    });
+    double shoot_time = nanoseconds_per_call(calls, [&](uint64_t i) {
+        const auto& layout = positions[i % layouts];
+        b.my_worms[0].p = layout[0];
+        for (uint8_t w = 0; w < 3; w++) b.opponent_worms[w].p = layout[w + 1];
+        sink += b.shoot_candidates(b.my_worms[0], b.my_worms, b.opponent_worms);
+    });
+    cout << fixed << setprecision(1)
+         << "sqrt in range     " << setw(8) << sqrt_time << endl
+         << "squared in range  " << setw(8) << squared_time << endl
+         << "shoot candidates  " << setw(8) << shoot_time << endl;
+}
+
+// The per-playout cost outside the tree: copying the root board into the
+// simulation and playing it out.
+void copy_and_rollout(const board<MAP_WIDTH>& b) {
+    const uint64_t copies = 1000000, rollouts = 2000;
+    simulation<MAP_WIDTH> sim(b);
+    cout << "board copy and rollout (" << sizeof(board<MAP_WIDTH>) << " byte board)" << endl;
+    double copy_time = nanoseconds_per_call(copies, [&](uint64_t i) {
+        sim.b = b;
+        sink += sim.b.hash;
+    });
+    double rollout_time = nanoseconds_per_call(rollouts, [&](uint64_t i) {
+        sim.b = b;
+        sim.rollout();
+        sink += sim.determine_score();
+    });
+    double cutoff_time = nanoseconds_per_call(rollouts * 5, [&](uint64_t i) {
+        sim.b = b;
+        sim.rollout(20);
+        sink += sim.determine_score();
+    });
+    cout << fixed << setprecision(1)
+         << "copy             " << setw(10) << copy_time << " ns" << endl
+         << "copy + rollout   " << setw(10) << rollout_time / 1000 << " us" << endl
+         << "cut off at 20    " << setw(10) << cutoff_time / 1000 << " us" << endl;
+}
+
+void layer_operations(const board<MAP_WIDTH>& b) {
+    const uint64_t calls = 1000000;
+    layer<MAP_WIDTH> result, open = b.air();
+    cout << "layer operations (ns per call)" << endl
+         << "                  scalar     simd" << endl;
+    auto row = [&](const char* name, auto scalar, auto simd) {
+        double scalar_time = nanoseconds_per_call(calls, scalar);
+        double simd_time = nanoseconds_per_call(calls, simd);
+        cout << fixed << setprecision(1) << name << setw(8) << scalar_time << setw(9)
+             << simd_time << endl;
+    };
+    row("or            ", [&](uint64_t i) {
+        scalar_rows_or(result.rows(), b.dirt.rows(), b.deep_space.rows(), MAP_WIDTH);
+        sink += result.rows()[i % MAP_WIDTH];
+    }, [&](uint64_t i) {
+        rows_or(result.rows(), b.dirt.rows(), b.deep_space.rows(), MAP_WIDTH);
+        sink += result.rows()[i % MAP_WIDTH];
+    });
+    row("dilate        ", [&](uint64_t i) {
+        scalar_rows_dilate(result.rows(), open.rows(), MAP_WIDTH, board<MAP_WIDTH>::ROW_MASK);
+        sink += result.rows()[i % MAP_WIDTH];
+    }, [&](uint64_t i) {
+        rows_dilate(result.rows(), open.rows(), MAP_WIDTH, board<MAP_WIDTH>::ROW_MASK);
+        sink += result.rows()[i % MAP_WIDTH];
+    });
+    row("popcount      ", [&](uint64_t i) {
+        open.rows()[i % MAP_WIDTH] ^= i;
+        sink += scalar_rows_popcount(open.rows(), MAP_WIDTH);
+    }, [&](uint64_t i) {
+        open.rows()[i % MAP_WIDTH] ^= i;
+        sink += rows_popcount(open.rows(), MAP_WIDTH);
+    });
+}
+
+template <typename RNG>
+double bounded_draw_time(uint64_t calls) {
+    random_buffer<RNG> rng;
+    return nanoseconds_per_call(calls, [&](uint64_t i) { sink += rng.below(1 + (i & 7)); });
+}
+
+// Draws below small bounds, as the rollout policy makes them.
+void random_draws() {
+    const uint64_t calls = 10000000;
+    mt19937 mt;
+    double mt_time = nanoseconds_per_call(calls, [&](uint64_t i) { sink += mt() % (1 + (i & 7)); });
+    cout << "bounded random draws (ns per call)" << endl << fixed << setprecision(2)
+         << "mt19937 %        " << setw(8) << mt_time << endl
+         << "xoshiro256**     " << setw(8) << bounded_draw_time<xoshiro256>(calls) << endl
+         << "pcg32            " << setw(8) << bounded_draw_time<pcg32>(calls) << endl;
+}
+
+uint8_t nth_set_bit_by_loop(uint8_t mask, uint8_t n) {
+    for (; n; n--) mask &= mask - 1;
+    return mask & -mask;
+}
+
+// Picking the k-th set bit of random direction masks, as select_direction
+// does for every worm on every rollout step.
+void direction_selection() {
+    const uint64_t calls = 10000000;
+    vector<pair<uint8_t, uint8_t>> picks(4096);
+    mt19937 mt(9);
+    for (auto& p : picks) {
+        p.first = 1 + mt() % 255;
+        p.second = mt() % __builtin_popcount(p.first);
+    }
+    double loop_time = nanoseconds_per_call(calls, [&](uint64_t i) {
+        auto& p = picks[i & 4095];
+        sink += nth_set_bit_by_loop(p.first, p.second);
+    });
+    double table_time = nanoseconds_per_call(calls, [&](uint64_t i) {
+        auto& p = picks[i & 4095];
+        sink += 1 << SET_BIT_TABLE.positions[p.first][p.second];
+    });
+    double selected_time = nanoseconds_per_call(calls, [&](uint64_t i) {
+        auto& p = picks[i & 4095];
+        sink += nth_set_bit(p.first, p.second);
+    });
+    cout << "k-th set bit (ns per call)" << endl << fixed << setprecision(2)
+         << "loop             " << setw(8) << loop_time << endl
+         << "table            " << setw(8) << table_time << endl
+#ifdef __BMI2__
+         << "pdep             " << setw(8) << selected_time << endl;
+#else
+         << "nth_set_bit      " << setw(8) << selected_time << endl;
+#endif
+}
+
+// Boards seen while playing out games from b, for timing the candidate
+// functions on the positions a rollout actually visits.
+template <uint8_t WIDTH>
+vector<board<WIDTH>> rollout_positions(const board<WIDTH>& b, uint32_t count) {
+    vector<board<WIDTH>> result;
+    simulation<WIDTH> sim(b);
+    while (result.size() < count) {
+        if (sim.game_has_finished()) sim.b = b;
+        result.push_back(sim.b);
+        sim.step();
+    }
+    return result;
+}
+
+template <uint8_t WIDTH, typename F>
+double candidates_time(vector<board<WIDTH>>& positions, uint64_t calls, F f) {
+    return nanoseconds_per_call(calls, [&](uint64_t i) {
+        board<WIDTH>& b = positions[i % positions.size()];
+        game_worm* mine = i & 1 ? b.opponent_worms : b.my_worms;
+        game_worm* yours = i & 1 ? b.my_worms : b.opponent_worms;
+        sink += f(b, mine[(i >> 1) % 3], mine, yours);
+    });
+}
+
+// Steps and rollouts of simulation<WIDTH> from b, the candidate functions
+// on positions reached from b, and the allocations made along the way.
+template <uint8_t WIDTH>
+void rollout_throughput(const board<WIDTH>& b, const string& name) {
+    const uint64_t steps = 1000000, rollouts = 2000, calls = 2000000;
+    simulation<WIDTH> sim(b);
+    uint64_t before = allocations;
+    auto start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < steps; i++) {
+        if (sim.game_has_finished()) sim.b = b;
+        sim.step();
+    }
+    double step_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    uint64_t step_allocations = allocations - before;
+    uint64_t played = 0;
+    before = allocations;
+    start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < rollouts; i++) {
+        sim.b = b;
+        played += sim.rollout();
+        sink += sim.determine_score();
+    }
+    double rollout_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    uint64_t rollout_allocations = allocations - before;
+
+    vector<board<WIDTH>> positions = rollout_positions(b, 4096);
+    double move_time = candidates_time(positions, calls, [](auto& b, auto w, auto m, auto y) {
+        return b.move_candidates(w, m);
+    });
+    double dig_time = candidates_time(positions, calls, [](auto& b, auto w, auto m, auto y) {
+        return b.dig_candidates(w, m);
+    });
+    double shoot_time = candidates_time(positions, calls, [](auto& b, auto w, auto m, auto y) {
+        return b.shoot_candidates(w, m, y);
+    });
+    distance_map<WIDTH> map;
+    double evaluate_time = nanoseconds_per_call(calls, [&](uint64_t i) {
+        sink += evaluate_board(positions[i % positions.size()], map);
+    });
+
+    cout << "rollout throughput on " << name << " (" << (int)WIDTH << "x" << (int)WIDTH << ")"
+         << endl << fixed << setprecision(0)
+         << "steps/s          " << setw(10) << steps / step_seconds << endl
+         << "rollouts/s       " << setw(10) << rollouts / rollout_seconds << "  ("
+         << setprecision(1) << (double)played / rollouts << " steps each)" << endl
+         << "move candidates  " << setw(10) << move_time << " ns" << endl
+         << "dig candidates   " << setw(10) << dig_time << " ns" << endl
+         << "shoot candidates " << setw(10) << shoot_time << " ns" << endl
+         << "evaluate         " << setw(10) << evaluate_time << " ns" << endl
+         << "allocations      " << setw(10) << step_allocations << " in steps, "
+         << rollout_allocations << " in rollouts" << endl;
+}
+
+// Breadth first search through air a cell at a time, for comparison.
+uint32_t cell_by_cell_distances(const board<MAP_WIDTH>& b, position source,
+                                uint8_t distances[MAP_WIDTH][MAP_WIDTH]) {
+    memset(distances, UNREACHABLE, MAP_WIDTH * MAP_WIDTH);
+    deque<position> queue = { source };
+    distances[source.y][source.x] = 0;
+    uint32_t reached = 1;
+    while (!queue.empty()) {
+        position current = queue.front();
+        queue.pop_front();
+        for (uint8_t d = 1; d; d <<= 1) {
+            position p = current + board<MAP_WIDTH>::direction_offset(d);
+            if (!b.on_board(p) || !(b.air_row(p.y) >> p.x & 1)) continue;
+            if (distances[p.y][p.x] != UNREACHABLE) continue;
+            distances[p.y][p.x] = distances[current.y][current.x] + 1;
+            queue.push_back(p);
+            reached++;
+        }
+    }
+    return reached;
+}
+
+void distance_maps(const board<MAP_WIDTH>& b) {
+    const uint64_t calls = 20000;
+    uint8_t distances[MAP_WIDTH][MAP_WIDTH];
+    distance_map<MAP_WIDTH> map;
+    position source = b.my_worms[0].p;
+    double queue_time = nanoseconds_per_call(calls, [&](uint64_t i) {
+        sink += cell_by_cell_distances(b, source, distances);
+    });
+    double air_time = nanoseconds_per_call(calls, [&](uint64_t i) {
+        map.compute(b, source, false);
+        sink += map.frontiers.size();
+    });
+    double dirt_time = nanoseconds_per_call(calls, [&](uint64_t i) {
+        map.compute(b, source, true);
+        sink += map.frontiers.size();
+    });
+    cout << "distance maps (us per call)" << endl << fixed << setprecision(2)
+         << "queue, air       " << setw(8) << queue_time / 1000 << endl
+         << "frontiers, air   " << setw(8) << air_time / 1000 << endl
+         << "frontiers, dirt  " << setw(8) << dirt_time / 1000 << endl;
+}
+
+template <typename POLICY>
+void policy_rollouts(const board<MAP_WIDTH>& b, const char* name) {
+    const uint64_t rollouts = 2000;
+    simulation<MAP_WIDTH, xoshiro256, POLICY> sim(b);
+    uint64_t decided = 0;
+    double rollout_time = nanoseconds_per_call(rollouts, [&](uint64_t i) {
+        sim.b = b;
+        sim.rollout();
+        decided += sim.game_has_finished() && sim.b.rounds_left;
+        sink += sim.determine_score();
+    });
+    search_config config;
+    config.budget = chrono::milliseconds(500);
+    config.arena_bytes = 1ULL << 28;
+    searcher<MAP_WIDTH, POLICY> s(config);
+    s.search(b);
+    cout << name << fixed << setprecision(1) << setw(10) << rollout_time / 1000
+         << setw(10) << 100.0 * decided / rollouts << setw(12) << setprecision(0)
+         << s.stats.playouts_per_second() << endl;
+}
+
+// The uniform rollout policy against the weighted one: cost per rollout,
+// the share of rollouts that end with one side wiped out before the cutoff,
+// and playouts per second searching.
+void rollout_policies(const board<MAP_WIDTH>& b) {
+    cout << "rollout policies       us   % decided  playouts/s" << endl;
+    policy_rollouts<light_policy>(b, "light        ");
+    policy_rollouts<heavy_policy>(b, "heavy        ");
+}
+
+void parallel_scaling(const board<MAP_WIDTH>& b, search_mode mode, uint32_t max_threads) {
+    cout << (mode == ROOT_PARALLEL ? "root" : "tree") << " parallel search, 500ms per search"
+         << endl;
+    double single = 0;
+    for (uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+        search_config config;
+        config.mode = threads == 1 ? SINGLE_THREADED : mode;
+        config.threads = threads;
+        config.arena_bytes = 1ULL << 28;
+        config.budget = chrono::milliseconds(500);
+        searcher<MAP_WIDTH> s(config);
+        s.search(b);
+        double rate = s.stats.playouts_per_second();
+        if (threads == 1) single = rate;
+        cout << setw(4) << threads << " threads " << setw(12) << fixed << setprecision(0)
+             << rate << " playouts/s  speedup " << setprecision(2) << rate / single << endl;
+    }
+}
+
+// bench [threads] [state.json...], the states default to the one in
+// test-data.
+int main(int argc, char** argv) {
+    uint32_t max_threads = argc > 1 ? atoi(argv[1]) : max(1U, thread::hardware_concurrency());
+    vector<string> states(argv + min(argc, 2), argv + argc);
+    if (states.empty()) states.push_back("test-data/bench-state.json");
+    sampling_comparison();
+    random_draws();
+    direction_selection();
+    read_data reader;
+    for (const string& path : states) {
+        with_board(reader.read_state(path), [&](auto b) { rollout_throughput(b, path); });
+    }
+    board<MAP_WIDTH> b = generate_board(1);
+    rollout_throughput(b, "generated map");
+    layer_operations(b);
+    shooting_throughput(b);
+    distance_maps(b);
+    copy_and_rollout(b);
+    rollout_policies(b);
+    parallel_scaling(b, ROOT_PARALLEL, max_threads);
+    parallel_scaling(b, TREE_PARALLEL, max_threads);
+    return 0;
+}
@@ -2,18 +2,39 @@
 #define _BOARD_H_
 
 #include "data.hpp"
+#include "zobrist.hpp"
+#include "shot_table.hpp"
+#include "layer_ops.hpp"
 #include <stdint.h>
 #include <vector>
 #include <assert.h>
 #include <iostream>
 #include <math.h>
 #include <algorithm>
+#include <stdexcept>
+#include <string>
 
 using namespace std;
 
+struct position {
+
+    position() : x(0), y(0) {}
+
+    position(int8_t x, int8_t y) : x(x), y(y) {}
+
+    position operator+(position other) { return position(x + other.x, y + other.y); }
+    bool operator==(position other) { return x == other.x && y == other.y; }
+    void operator+=(position other) { x += other.x; y += other.y; }
+
+    int8_t x;
+    int8_t y;
+};
+
 template <uint8_t WIDTH>
 struct layer {
 
+    static_assert(WIDTH < 64, "a row of a layer and the column past it must fit in a word");
+
     layer(const vector<vector<cell>>& map, const string& type) {
         assert(map.size() == WIDTH);
         for (auto row : map) {
@@ -22,18 +43,150 @@ struct layer {
                 uint8_t row_index = c.y;
                 uint64_t current_position_mask = 1ULL << c.x;
                 if (c.type == type) {
-                    rows[row_index] |= current_position_mask;
+                    rows()[row_index] |= current_position_mask;
                 }
                 current_position_mask <<= 1;
             }
         }
     }
 
+    layer() {}
+
     explicit layer(uint64_t* src_rows) {
-        memcpy(rows, src_rows, WIDTH * sizeof(uint64_t));
+        memcpy(rows(), src_rows, WIDTH * sizeof(uint64_t));
+    }
+
+    bool contains(position p) const {
+        return rows()[p.y] >> p.x & 1;
+    }
+
+    void set(position p) { rows()[p.y] |= 1ULL << p.x; }
+    void clear(position p) { rows()[p.y] &= ~(1ULL << p.x); }
+
+    layer operator|(const layer& other) const {
+        layer result;
+        rows_or(result.rows(), rows(), other.rows(), WIDTH);
+        return result;
     }
 
-    uint64_t rows[WIDTH] = {0};
+    layer operator&(const layer& other) const {
+        layer result;
+        rows_and(result.rows(), rows(), other.rows(), WIDTH);
+        return result;
+    }
+
+    layer and_not(const layer& other) const {
+        layer result;
+        rows_and_not(result.rows(), rows(), other.rows(), WIDTH);
+        return result;
+    }
+
+    // The cells set here and their eight neighbours.
+    layer dilate() const {
+        layer result;
+        rows_dilate(result.rows(), rows(), WIDTH, (1ULL << WIDTH) - 1);
+        return result;
+    }
+
+    uint32_t count() const {
+        return rows_popcount(rows(), WIDTH);
+    }
+
+    bool empty() const {
+        uint64_t any = 0;
+        for (uint8_t y = 0; y < WIDTH; y++) any |= rows()[y];
+        return !any;
+    }
+
+    static layer filled() {
+        layer result;
+        for (uint8_t y = 0; y < WIDTH; y++) result.rows()[y] = (1ULL << WIDTH) - 1;
+        return result;
+    }
+
+    // The row either side of the board, read through padded_row. Both are
+    // zero unless set, the board sets them to deep space.
+    uint64_t padded_row(int8_t y) const { return padded_rows[y + 1]; }
+
+    void set_border(uint64_t row) { padded_rows[0] = padded_rows[WIDTH + 1] = row; }
+
+    uint64_t* rows() { return padded_rows + 1; }
+    const uint64_t* rows() const { return padded_rows + 1; }
+
+    // The rows of the board start at padded_rows[1].
+    uint64_t padded_rows[WIDTH + 2] = {0};
+
+};
+
+enum line_orientation : uint8_t {
+    HORIZONTAL = 0,
+    VERTICAL = 1,
+    DIAGONAL = 2,
+    ANTI_DIAGONAL = 3
+};
+
+// Copies of a layer with the cells of each column, diagonal (x - y
+// constant) and anti-diagonal (x + y constant) packed into one word, so a
+// line of cells in any direction can be tested with a single mask. Cells
+// are indexed by y along a column and by x along either diagonal.
+template <uint8_t WIDTH>
+struct rotated_layer {
+
+    static const uint8_t DIAGONALS = 2 * WIDTH - 1;
+
+    rotated_layer() {}
+
+    explicit rotated_layer(const layer<WIDTH>& l) {
+        for (int8_t y = 0; y < WIDTH; y++) {
+            for (uint64_t row = l.rows()[y]; row; row &= row - 1) {
+                set(position(__builtin_ctzll(row), y));
+            }
+        }
+    }
+
+    static uint8_t line_of(position p, line_orientation o) {
+        switch (o) {
+        case HORIZONTAL: return p.y;
+        case VERTICAL: return p.x;
+        case DIAGONAL: return p.x - p.y + WIDTH - 1;
+        default: return p.x + p.y;
+        }
+    }
+
+    static uint8_t index_of(position p, line_orientation o) {
+        return o == VERTICAL ? p.y : p.x;
+    }
+
+    static position cell_at(line_orientation o, uint8_t line, uint8_t index) {
+        switch (o) {
+        case HORIZONTAL: return position(index, line);
+        case VERTICAL: return position(line, index);
+        case DIAGONAL: return position(index, index - line + WIDTH - 1);
+        default: return position(index, line - index);
+        }
+    }
+
+    // Horizontal lines aren't stored, they are the rows of the layer itself.
+    uint64_t line(line_orientation o, uint8_t l) const {
+        assert(o != HORIZONTAL);
+        return o == VERTICAL ? columns[l] : o == DIAGONAL ? diagonals[l] : anti_diagonals[l];
+    }
+
+    void set(position p) {
+        columns[p.x] |= 1ULL << p.y;
+        diagonals[line_of(p, DIAGONAL)] |= 1ULL << p.x;
+        anti_diagonals[line_of(p, ANTI_DIAGONAL)] |= 1ULL << p.x;
+    }
+
+    void clear(position p) {
+        columns[p.x] &= ~(1ULL << p.y);
+        diagonals[line_of(p, DIAGONAL)] &= ~(1ULL << p.x);
+        anti_diagonals[line_of(p, ANTI_DIAGONAL)] &= ~(1ULL << p.x);
+    }
+
+    uint64_t columns[WIDTH] = {0};
+    uint64_t diagonals[DIAGONALS] = {0};
+    uint64_t anti_diagonals[DIAGONALS] = {0};
 
 };
 
@@ -56,20 +209,6 @@ enum action : uint8_t {
     SHOOT = 4
 };
 
-struct position {
-
-    position() {}
-
-    position(int8_t x, int8_t y) : x(x), y(y) {}
-
-    position operator+(position other) { return position(x + other.x, y + other.y); }
-    bool operator==(position other) { return x == other.x && y == other.y; }
-    void operator+=(position other) { x += other.x; y += other.y; }
-
-    int8_t x;
-    int8_t y;
-};
-
 struct selected_action {
 
     position p;
@@ -78,11 +217,11 @@ struct selected_action {
 
 struct game_worm {
 
-    game_worm() {}
+    game_worm() : p(0, 0), health(0) {}
 
     game_worm(uint8_t x, uint8_t y, uint16_t health) : p(x, y), health(health) {}
 
-    bool is_alive() { return health > 0; }
+    bool is_alive() const { return health > 0; }
 
     position p;
     int16_t health;
@@ -90,21 +229,31 @@ struct game_worm {
 
 };
 
+// The number of rounds in a game when the state doesn't say otherwise.
+const uint16_t MAX_ROUNDS = 400;
+
 template<uint8_t WIDTH>
 struct board {
 
+    static_assert(WIDTH < 64, "a row of the board must fit in a word");
+    static const uint64_t ROW_MASK = (1ULL << WIDTH) - 1;
+
+    // Air is whatever isn't dirt or deep space, so the air layer is unused;
+    // it is still taken so that boards can be written out cell type by cell
+    // type.
     board(const layer<WIDTH>& dirt,
-          const layer<WIDTH>& air,
+          const layer<WIDTH>& /* air */,
           const layer<WIDTH>& deep_space,
           uint8_t damage, uint8_t range,
-          uint8_t digging_range) : dirt(dirt), air(air), deep_space(deep_space),
-                                   damage(damage), range(range), digging_range(digging_range) {}
+          uint8_t digging_range) : dirt(dirt), deep_space(deep_space),
+                                   damage(damage), range(range), digging_range(digging_range) {
+        refresh();
+    }
 
     board(const vector<vector<cell>>& map,
           const vector<my_worm>& mine,
           const vector<worm>& yours) :
         deep_space(map, "DEEP_SPACE"),
-        air(map, "AIR"),
         dirt(map, "DIRT") {
 
         assert(mine.size() <= 3);
@@ -124,6 +273,102 @@ struct board {
             opponent_worms[index++] = game_worm(w.position.x, w.position.y, w.health);
         }
 
+        refresh();
+    }
+
+    // Recomputes the hash and occupancy, which the board otherwise keeps up
+    // to date itself, after worms have been edited directly.
+    void refresh() {
+        deep_space.set_border(ROW_MASK);
+        hash = compute_hash();
+        rotated_obstructions = rotated_layer<WIDTH>(dirt | deep_space);
+        for (uint8_t side = 0; side < 2; side++) {
+            occupied[side] = layer<WIDTH>();
+            move_targets[side] = layer<WIDTH>();
+            game_worm* worms = side ? opponent_worms : my_worms;
+            for (game_worm* it = worms; it != worms + 3; it++) {
+                if (it->is_alive()) occupied[side].set(it->p);
+                if (it->action.a == MOVE && on_board(it->p + it->action.p)) {
+                    move_targets[side].set(it->p + it->action.p);
+                }
+            }
+        }
+    }
+
+    uint8_t worm_slot(const game_worm* w) {
+        return w >= opponent_worms && w < opponent_worms + 3 ?
+            3 + (w - opponent_worms) : w - my_worms;
+    }
+
+    uint64_t worm_position_key(uint8_t slot, position p) {
+        return zobrist_key(WORM_POSITION, slot, p.y * WIDTH + p.x);
+    }
+
+    uint64_t worm_health_key(uint8_t slot, int16_t health) {
+        return zobrist_key(WORM_HEALTH, slot, health_bucket(health));
+    }
+
+    // Hash of the terrain, worm positions and bucketed worm health. It is
+    // kept up to date by move_worm, dig_cell and damage_worm, anything
+    // that edits the board directly has to recompute it.
+    uint64_t compute_hash() {
+        uint64_t result = 0;
+        for (uint8_t y = 0; y < WIDTH; y++) {
+            for (uint8_t x = 0; x < WIDTH; x++) {
+                uint64_t mask = 1ULL << x;
+                uint16_t index = y * WIDTH + x;
+                if (dirt.rows()[y] & mask) result ^= zobrist_key(DIRT_CELL, 0, index);
+                if (air_row(y) & mask) result ^= zobrist_key(AIR_CELL, 0, index);
+                if (deep_space.rows()[y] & mask) result ^= zobrist_key(DEEP_SPACE_CELL, 0, index);
+            }
+        }
+        for (uint8_t slot = 0; slot < 6; slot++) {
+            game_worm& w = slot < 3 ? my_worms[slot] : opponent_worms[slot - 3];
+            result ^= worm_position_key(slot, w.p) ^ worm_health_key(slot, w.health);
+        }
+        return result;
+    }
+
+    void move_worm(game_worm* w, position destination) {
+        uint8_t slot = worm_slot(w);
+        hash ^= worm_position_key(slot, w->p) ^ worm_position_key(slot, destination);
+        layer<WIDTH>& side = occupied[slot < 3 ? 0 : 1];
+        side.clear(w->p);
+        side.set(destination);
+        w->p = destination;
+    }
+
+    bool on_board(position p) const {
+        return p.x >= 0 && p.x < WIDTH && p.y >= 0 && p.y < WIDTH;
+    }
+
+    // Actions go through here so that the cells worms are about to move to
+    // stay in move_targets until the move is made or the round is over.
+    void set_action(game_worm* w, selected_action a) {
+        uint8_t side = worm_slot(w) < 3 ? 0 : 1;
+        if (w->action.a == MOVE && on_board(w->p + w->action.p)) {
+            move_targets[side].clear(w->p + w->action.p);
+        }
+        w->action = a;
+        if (a.a == MOVE && on_board(w->p + a.p)) move_targets[side].set(w->p + a.p);
+    }
+
+    void dig_cell(position p) {
+        uint64_t mask = 1ULL << p.x;
+        if (!(dirt.rows()[p.y] & mask)) return;
+        dirt.rows()[p.y] ^= mask;
+        rotated_obstructions.clear(p);
+        uint16_t index = p.y * WIDTH + p.x;
+        hash ^= zobrist_key(DIRT_CELL, 0, index) ^ zobrist_key(AIR_CELL, 0, index);
+    }
+
+    void damage_worm(game_worm* w, int16_t amount) {
+        uint8_t slot = worm_slot(w);
+        hash ^= worm_health_key(slot, w->health);
+        bool was_alive = w->is_alive();
+        w->health -= amount;
+        hash ^= worm_health_key(slot, w->health);
+        if (was_alive && !w->is_alive()) occupied[slot < 3 ? 0 : 1].clear(w->p);
     }
 
     direction direction_between(position one, position other) {
@@ -155,86 +400,70 @@ struct board {
         return NONE;
     }
 
+    // Whether a living enemy stands on the straight line strictly between
+    // one and other.
     bool enemy_between(position one, position other, game_worm* enemies) {
-        for (game_worm* it = enemies; it != enemies + 3; it++) {
-            game_worm enemy = *it;
-            if (!in_range(one, enemy.p)) continue;
-            if (direction_between(one, enemy.p) == direction_between(enemy.p, other)) {
-                return true;
-            }
+        int8_t dx = other.x - one.x, dy = other.y - one.y;
+        if ((dx == 0 && dy == 0) || (dx != 0 && dy != 0 && abs(dx) != abs(dy))) return false;
+        position step((dx > 0) - (dx < 0), (dy > 0) - (dy < 0));
+        const layer<WIDTH>& enemy_cells = occupied[side_of(enemies)];
+        for (position p = one + step; !(p == other); p += step) {
+            if (enemy_cells.contains(p)) return true;
         }
         return false;
     }
 
-    bool will_open_shoot_path_to_friendly(position p, game_worm* mine, game_worm* enemies) {
+    // Marks the dirt between a worm that has chosen to shoot and any
+    // friendly worm further along its line of fire, digging any of it out
+    // this round would let the shot through to the friendly worm.
+    void add_shot_danger(game_worm shooter, game_worm* mine, game_worm* enemies) {
+        layer<WIDTH>& cells = danger[side_of(mine)];
         for (game_worm* it = mine; it != mine + 3; it++) {
-            game_worm one = *it;
-            if (one.action.a == SHOOT) {
-                for (game_worm* it_other = mine; it_other != mine + 3; it_other++) {
-                    game_worm other = *it_other;
-                    if (!in_range(one.p, other.p)) continue;
-                    if (direction_between(one.p, other.p) == NONE) continue;
-                    if (enemy_between(one.p, other.p, enemies)) continue;
-                    if (has_clear_path(one.p, p, mine) && has_clear_path(other.p, p, mine)) {
-                        return true;
-                    }
+            game_worm other = *it;
+            if (!other.is_alive() || other.p == shooter.p) continue;
+            int8_t dx = other.p.x - shooter.p.x, dy = other.p.y - shooter.p.y;
+            if (dx != 0 && dy != 0 && abs(dx) != abs(dy)) continue;
+            position step((dx > 0) - (dx < 0), (dy > 0) - (dy < 0));
+            if (!(step == shooter.action.p)) continue;
+            if (!in_range(shooter.p, other.p)) continue;
+            if (enemy_between(shooter.p, other.p, enemies)) continue;
+            for (position p = shooter.p + step; !(p == other.p); p += step) {
+                if (dirt.contains(p)) {
+                    cells.set(p);
+                    has_danger[side_of(mine)] = true;
                 }
             }
         }
-        return false;
     }
 
-    uint8_t dig_candidates(game_worm w, game_worm* mine, game_worm* enemies) {
-        uint8_t result = 0;
-        if (w.p.y > 0) {
-            uint64_t up_one_row = dirt.rows[w.p.y - 1];
-            result |= ((1ULL << w.p.x) & up_one_row) &&
-                !will_open_shoot_path_to_friendly(position(w.p.x, w.p.y - 1), mine, enemies)
-                ? N : 0;
-            result |= w.p.x > 0 && ((1ULL << (w.p.x - 1)) & up_one_row) &&
-                !will_open_shoot_path_to_friendly(position(w.p.x - 1, w.p.y - 1), mine, enemies)
-                ? NW : 0;
-            result |= w.p.x < WIDTH && ((1ULL << (w.p.x + 1)) & up_one_row) &&
-                !will_open_shoot_path_to_friendly(position(w.p.y - 1, w.p.x + 1), mine, enemies)
-                ? NE : 0;
-        }
-
-        uint64_t row = dirt.rows[w.p.y];
-        result |= w.p.x > 0 && ((1ULL << (w.p.x - 1)) & row) &&
-            !will_open_shoot_path_to_friendly(position(w.p.y, w.p.x - 1), mine, enemies) ? W : 0;
-        result |= w.p.x < WIDTH && ((1ULL << (w.p.x + 1)) & row) &&
-            !will_open_shoot_path_to_friendly(position(w.p.y, w.p.x + 1), mine, enemies) ? E : 0;
-
-        if (w.p.y < WIDTH) {
-            uint64_t down_one_row = dirt.rows[w.p.y + 1];
-            result |= ((1ULL << w.p.x) & down_one_row) &&
-                !will_open_shoot_path_to_friendly(position(w.p.y + 1, w.p.x), mine, enemies)
-                ? S : 0;
-            result |= w.p.x > 0 && ((1ULL << (w.p.x - 1)) & down_one_row) &&
-                !will_open_shoot_path_to_friendly(position(w.p.y + 1, w.p.x - 1), mine, enemies)
-                ? SW : 0;
-            result |= w.p.x < WIDTH && ((1ULL << (w.p.x + 1)) & down_one_row) &&
-                !will_open_shoot_path_to_friendly(position(w.p.y + 1, w.p.x + 1), mine, enemies)
-                ? SE : 0;
-        }
+    // y may be the row either side of the board, see padded_row.
+    uint64_t diggable_row(game_worm* mine, int8_t y) {
+        return dirt.padded_row(y) & ~danger[side_of(mine)].padded_row(y);
+    }
 
-        return result;
+    uint8_t dig_candidates(game_worm w, game_worm* mine) {
+        return neighbour_directions(diggable_row(mine, w.p.y - 1), diggable_row(mine, w.p.y),
+                                    diggable_row(mine, w.p.y + 1), w.p.x);
     }
 
     bool between(uint8_t start, uint8_t between, uint8_t end) {
         return start <= between && between <= end;
     }
 
-    double euclidean_distance(position one, position other) {
-        if (one.x == other.x) return abs(one.y - other.y);
-        if (one.y == other.y) return abs(one.x - other.x);
-        int16_t delx = one.x - other.x;
-        int16_t dely = one.y - other.y;
-        return sqrt(delx * delx + dely * dely);
+    static int32_t squared_distance(position one, position other) {
+        int32_t dx = one.x - other.x, dy = one.y - other.y;
+        return dx * dx + dy * dy;
     }
 
+    // Within range + sqrt(2), so a worm that moves one cell might end up in
+    // range.
     bool in_range(position one, position other) {
-        return euclidean_distance(one, other) <= range + sqrt(2);
+        assert(range <= MAX_SHOT_RANGE);
+        return squared_distance(one, other) <= SHOT_TABLE.in_range[range];
+    }
+
+    bool within_weapon_range(position one, position other) const {
+        return squared_distance(one, other) <= range * range;
     }
 
     bool friendly_is_digging_cell(position p, game_worm* mine) {
@@ -251,8 +480,8 @@ struct board {
         for (uint8_t x = one.x, y = one.y; (x != other.x || y != other.y);
              y = min<uint8_t>(y+1, other.y), x = min<uint8_t>(x + 1, other.x)) {
             uint64_t row_mask = 1ULL << x;
-            if (deep_space.rows[y] & row_mask) return false;
-            if (dirt.rows[y] & row_mask && !friendly_is_digging_cell(position(x, y), mine)) {
+            if (deep_space.rows()[y] & row_mask) return false;
+            if (dirt.rows()[y] & row_mask && !friendly_is_digging_cell(position(x, y), mine)) {
                 return false;
             }
         }
@@ -279,239 +508,179 @@ struct board {
             !friendly_worm_will_be_at_position(p, mine);
     }
 
-    uint8_t move_candidates(game_worm w, game_worm* mine) {
-        uint8_t result = 0;
-        if (w.p.y > 0) {
-            uint64_t up_one_row = air.rows[w.p.y - 1];
-            result |= safe_to_move_to(mine, position(w.p.x, w.p.y - 1))
-                     && ((1ULL << w.p.x) & up_one_row) ? N : 0;
-            result |= w.p.x > 0 &&
-                safe_to_move_to(mine, position(w.p.x - 1, w.p.y - 1))
-                && ((1ULL << (w.p.x - 1)) & up_one_row) ? NW : 0;
-            result |= w.p.x < WIDTH &&
-                              safe_to_move_to(mine, position(w.p.x + 1, w.p.y - 1))
-                              && ((1ULL << (w.p.x + 1)) & up_one_row) ? NE : 0;
-        }
+    // Directions from column x whose cells are set in the rows above,
+    // level with and below the worm.
+    static uint8_t neighbour_directions(uint64_t above, uint64_t row, uint64_t below,
+                                        uint8_t x) {
+        uint64_t top = (above << 1) >> x;
+        uint64_t middle = (row << 1) >> x;
+        uint64_t bottom = (below << 1) >> x;
+        return ((top >> 1) & 1) | ((top >> 2) & 1) << 1 | ((middle >> 2) & 1) << 2 |
+            ((bottom >> 2) & 1) << 3 | ((bottom >> 1) & 1) << 4 | (bottom & 1) << 5 |
+            (middle & 1) << 6 | (top & 1) << 7;
+    }
 
-        uint64_t row = air.rows[w.p.y];
-        result |= w.p.x > 0 && safe_to_move_to(mine, position(w.p.x - 1, w.p.y))
-            && ((1ULL << (w.p.x - 1)) & row) ? W : 0;
-        result |= w.p.x < WIDTH &&
-                          safe_to_move_to(mine, position(w.p.x + 1, w.p.y))
-                        && ((1ULL << (w.p.x + 1)) & row) ? E : 0;
-
-        if (w.p.y < WIDTH) {
-            uint64_t down_one_row = air.rows[w.p.y + 1];
-            result |= safe_to_move_to(mine, position(w.p.x, w.p.y + 1))
-                && ((1ULL << w.p.x) & down_one_row) ? S : 0;
-            result |= w.p.x > 0 &&
-                safe_to_move_to(mine, position(w.p.x - 1, w.p.y))
-                && ((1ULL << (w.p.x - 1)) & down_one_row) ? SW : 0;
-            result |= w.p.x < WIDTH &&
-                              safe_to_move_to(mine, position(w.p.x + 1, w.p.y))
-                            && ((1ULL << (w.p.x + 1)) & down_one_row) ? SE : 0;
-        }
-        return result;
+    uint8_t side_of(const game_worm* worms) {
+        return worms == opponent_worms ? 1 : 0;
     }
 
-    bool obstructed(position p) {
-        return get_obstructions(p.y) & 1ULL << p.x;
+    // Cells a worm can't move into because a friendly worm is there or has
+    // already chosen to move there this round.
+    uint64_t friendly_blocked_row(game_worm* mine, int8_t y) {
+        return occupied[side_of(mine)].padded_row(y) | move_targets[side_of(mine)].padded_row(y);
     }
 
-    bool friendly_worm_will_be_at_position(position p, game_worm* mine) {
-        for (auto it = mine; it < mine + 3; it++) {
-            game_worm w = *it;
-            if (!w.is_alive()) continue;
-            if (w.action.a == MOVE && w.p + w.action.p == p)
-                return true;
-            else if (w.p == p) return true;
-        }
-        return false;
+    // The rows either side of the board are deep space, so there is no air
+    // in them and no bounds check is needed.
+    uint64_t open_row(game_worm* mine, int8_t y) {
+        return air_row(y) & ~friendly_blocked_row(mine, y);
     }
 
-    bool dirt_might_get_dug_out(position p, game_worm enemy_to_shoot,
-                                game_worm* mine, game_worm* opponents) {
-        for (game_worm* it = mine; it < mine + 3; it++) {
-            if (dirt_cell_might_get_dug_out_by_my_worm(p, *it)) return true;
+    uint8_t move_candidates(game_worm w, game_worm* mine) {
+        uint8_t result = neighbour_directions(open_row(mine, w.p.y - 1), open_row(mine, w.p.y),
+                                              open_row(mine, w.p.y + 1), w.p.x);
+        bool friendly_shooting = false;
+        for (game_worm* it = mine; it != mine + 3; it++) {
+            friendly_shooting |= it->action.a == SHOOT;
         }
-        for (game_worm* it = opponents; it < opponents + 3; it++) {
-            game_worm w = *it;
-            if (w.p == enemy_to_shoot.p) continue;
-            if (abs(w.p.y - p.y) <= 1 && abs(w.p.x - p.x) <= 1) return true;
+        if (!friendly_shooting) return result;
+        for (uint8_t remaining = result; remaining; remaining &= remaining - 1) {
+            uint8_t d = remaining & -remaining;
+            if (friendly_worm_will_shoot_at_position(mine, w.p + direction_offset(d))) {
+                result ^= d;
+            }
         }
-        return false;
+        return result;
     }
 
-    bool dirt_cell_might_get_dug_out_by_my_worm(position p, game_worm w) {
-        return (w.action.a == DIG) && w.p + w.action.p == p;
+    static position direction_offset(uint8_t d) {
+        static const position offsets[8] = { {0, -1}, {1, -1}, {1, 0}, {1, 1},
+                                             {0, 1}, {-1, 1}, {-1, 0}, {-1, -1} };
+        return offsets[__builtin_ctz(d)];
     }
 
-    bool might_shoot_north(game_worm w, game_worm in_range_enemy,
-                           game_worm* mine, game_worm* opponents) {
-        if (abs(w.p.x - in_range_enemy.p.x) > 1 || w.p.y < in_range_enemy.p.y) return false;
-        uint8_t distance = min(range, (uint8_t)abs(w.p.y - in_range_enemy.p.y));
-        uint64_t row_mask = 1ULL << w.p.x;
-        for (uint8_t i = 1; i <= distance; i++) {
-            position p(w.p.x, w.p.y - i);
-            if ((get_obstructions(p.y) & row_mask) &&
-                !dirt_might_get_dug_out(p, in_range_enemy, mine, opponents))
-                return false;
-            if (friendly_worm_will_be_at_position(p, mine)) return false;
-        }
-        return true;
+    bool obstructed(position p) {
+        return get_obstructions(p.y) & 1ULL << p.x;
     }
 
-    bool might_shoot_south(game_worm w, game_worm in_range_enemy,
-                           game_worm* mine, game_worm* opponents) {
-        if (abs(w.p.x - in_range_enemy.p.x) > 1 || w.p.y > in_range_enemy.p.y) return false;
-        uint8_t distance = min(range, (uint8_t)abs(w.p.y - in_range_enemy.p.y));
-        uint64_t row_mask = 1ULL << w.p.x;
-        for (uint8_t i = 1; i <= distance; i++) {
-            position p(w.p.x, w.p.y + i);
-            if ((get_obstructions(p.y) & row_mask) &&
-                !dirt_might_get_dug_out(p, in_range_enemy, mine, opponents))
-                return false;
-            if (friendly_worm_will_be_at_position(p, mine)) return false;
-        }
-        return true;
+    bool friendly_worm_will_be_at_position(position p, game_worm* mine) {
+        return friendly_blocked_row(mine, p.y) >> p.x & 1;
     }
 
-    bool might_shoot_west(game_worm w, game_worm in_range_enemy,
-                          game_worm* mine, game_worm* opponents) {
-        if (abs(w.p.y - in_range_enemy.p.y) > 1 || w.p.x < in_range_enemy.p.x) return false;
-        uint8_t distance = min(range, (uint8_t)abs(w.p.x - in_range_enemy.p.x));
-        uint64_t current_row = get_obstructions(w.p.y);
-        for (uint8_t i = 1; i <= distance; i++) {
-            position p(w.p.x - i, w.p.y);
-            if ((current_row & (1ULL << p.x)) &&
-                !dirt_might_get_dug_out(p, in_range_enemy, mine, opponents))
-                return false;
-            if (friendly_worm_will_be_at_position(p, mine)) return false;
-        }
-        return true;
+    uint64_t get_obstructions(int8_t row) const {
+        return dirt.padded_row(row) | deep_space.padded_row(row);
     }
 
-    bool might_shoot_east(game_worm w, game_worm in_range_enemy,
-                          game_worm* mine, game_worm* opponents) {
-        if (abs(w.p.y - in_range_enemy.p.y) > 1 || w.p.x > in_range_enemy.p.x) return false;
-        uint8_t distance = min(range, (uint8_t)abs(w.p.x - in_range_enemy.p.x));
-        uint64_t current_row = get_obstructions(w.p.y);
-        for (uint8_t i = 1; i <= distance; i++) {
-            position p(w.p.x + i, w.p.y);
-            if ((current_row & (1ULL << p.x)) &&
-                !dirt_might_get_dug_out(p, in_range_enemy, mine, opponents))
-                return false;
-            if (friendly_worm_will_be_at_position(p, mine)) return false;
-        }
-        return true;
+    // Every cell is exactly one of dirt, deep space and air, so air isn't
+    // stored.
+    uint64_t air_row(int8_t row) const {
+        return ~get_obstructions(row) & ROW_MASK;
     }
 
-    bool might_shoot_ne(game_worm w, game_worm in_range_enemy,
-                        double distance, game_worm* mine, game_worm* opponents) {
-        if (abs(w.p.x - in_range_enemy.p.x - (in_range_enemy.p.y - w.p.y)) > 1 ||
-            w.p.x > in_range_enemy.p.x) return false;
-        distance = min((double)range, distance);
-        double root_two = sqrt(2);
-        for (uint8_t i = 1; i * root_two <= distance; i++) {
-            position p(w.p.x + i, w.p.y - i);
-            if ((get_obstructions(p.y) & (1ULL << p.x)) &&
-                !dirt_might_get_dug_out(p, in_range_enemy, mine, opponents))
-                return false;
-            if (friendly_worm_will_be_at_position(p, mine)) return false;
-        }
-        return true;
+    layer<WIDTH> air() const {
+        return layer<WIDTH>::filled().and_not(dirt | deep_space);
     }
 
-    bool might_shoot_se(game_worm w, game_worm in_range_enemy,
-                        double distance, game_worm* mine, game_worm* opponents) {
-        if (abs(w.p.x - w.p.y - (in_range_enemy.p.x - in_range_enemy.p.y)) > 1 ||
-            w.p.x > in_range_enemy.p.x) return false;
-        double root_two = sqrt(2);
-        distance = min((double)range, distance);
-        for (uint8_t i = 1; i * root_two <= distance; i++) {
-            position p(w.p.x + i, w.p.y + i);
-            if ((get_obstructions(p.y) & (1ULL << p.x)) &&
-                !dirt_might_get_dug_out(p, in_range_enemy, mine, opponents))
-                return false;
-            if (friendly_worm_will_be_at_position(p, mine)) return false;
+    // Whether dirt at p might be gone before a shot at target lands, because
+    // a friendly worm is digging it or another enemy is next to it.
+    bool might_get_dug_out(position p, game_worm target, game_worm* mine,
+                           game_worm* opponents) {
+        if (!dirt.contains(p)) return false;
+        for (game_worm* it = mine; it != mine + 3; it++) {
+            if (it->action.a == DIG && it->p + it->action.p == p) return true;
         }
-        return true;
+        for (game_worm* it = opponents; it != opponents + 3; it++) {
+            if (!it->is_alive() || it->p == target.p) continue;
+            if (abs(it->p.y - p.y) <= 1 && abs(it->p.x - p.x) <= 1) return true;
+        }
+        return false;
     }
 
-    bool might_shoot_nw(game_worm w, game_worm in_range_enemy,
-                        double distance, game_worm* mine, game_worm* opponents) {
-        if (abs(w.p.x - w.p.y - (in_range_enemy.p.x - in_range_enemy.p.y)) > 1 ||
-            w.p.x < in_range_enemy.p.x) return false;
-        double root_two = sqrt(2);
-        distance = min((double)range, distance);
-        for (uint8_t i = 1; i * root_two <= distance; i++) {
-            position p(w.p.x - i, w.p.y - i);
-            if ((get_obstructions(p.y) & (1ULL << p.x)) &&
-                !dirt_might_get_dug_out(p, in_range_enemy, mine, opponents))
-                return false;
-            if (friendly_worm_will_be_at_position(p, mine)) return false;
-        }
-        return true;
+    uint64_t obstruction_line(line_orientation o, uint8_t line) const {
+        return o == HORIZONTAL ? get_obstructions(line) : rotated_obstructions.line(o, line);
     }
 
-    uint64_t get_obstructions(uint8_t row) {
-        return dirt.rows[row] | deep_space.rows[row];
+    // Whether one and other are on a row, column or diagonal with only air
+    // strictly between them.
+    bool clear_line(position one, position other) const {
+        int8_t dx = other.x - one.x, dy = other.y - one.y;
+        if ((dx == 0 && dy == 0) || (dx != 0 && dy != 0 && abs(dx) != abs(dy))) return false;
+        line_orientation o = dy == 0 ? HORIZONTAL : dx == 0 ? VERTICAL :
+            dx == dy ? DIAGONAL : ANTI_DIAGONAL;
+        uint8_t from = rotated_layer<WIDTH>::index_of(one, o);
+        uint8_t to = rotated_layer<WIDTH>::index_of(other, o);
+        if (from > to) swap(from, to);
+        uint64_t between = (1ULL << to) - (2ULL << from);
+        return !(obstruction_line(o, rotated_layer<WIDTH>::line_of(one, o)) & between);
     }
 
-    bool might_shoot_sw(game_worm w, game_worm in_range_enemy,
-                        double distance, game_worm* mine, game_worm* opponents) {
-        if (abs(w.p.x - in_range_enemy.p.x - (in_range_enemy.p.y - w.p.y)) > 1 ||
-            w.p.x < in_range_enemy.p.x) return false;
-        double root_two = sqrt(2);
-        distance = min((double)range, distance);
-        for (uint8_t i = 1; i * root_two <= distance; i++) {
-            position p(w.p.x - i, w.p.y + i);
-            if ((get_obstructions(p.y) & (1ULL << p.x)) &&
-                !dirt_might_get_dug_out(p, in_range_enemy, mine, opponents))
-                return false;
-            if (friendly_worm_will_be_at_position(p, mine)) return false;
+    static line_orientation orientation_of(uint8_t d) {
+        static const line_orientation orientations[8] = {
+            VERTICAL, ANTI_DIAGONAL, HORIZONTAL, DIAGONAL,
+            VERTICAL, ANTI_DIAGONAL, HORIZONTAL, DIAGONAL };
+        return orientations[d];
+    }
+
+    // Whether the first steps cells from p in direction d (a direction bit
+    // index) might be clear when the shot is taken. The obstructions along
+    // the line are found with one mask over the row, column or diagonal.
+    // The few obstructions found that might be dug out, and the friendly
+    // worms, are checked cell by cell.
+    bool line_of_fire_clear(position p, uint8_t d, uint8_t steps, game_worm target,
+                            game_worm* mine, game_worm* opponents) {
+        if (steps == 0) return true;
+        line_orientation o = orientation_of(d);
+        uint8_t line = rotated_layer<WIDTH>::line_of(p, o);
+        uint8_t index = rotated_layer<WIDTH>::index_of(p, o);
+        int8_t step = o == VERTICAL ? DIRECTION_DY[d] : DIRECTION_DX[d];
+        if (step < 0 && steps > index) return false;
+        uint64_t ray = ((1ULL << steps) - 1) << (step > 0 ? index + 1 : index - steps);
+        for (uint64_t blocked = obstruction_line(o, line) & ray; blocked;
+             blocked &= blocked - 1) {
+            position q = rotated_layer<WIDTH>::cell_at(o, line, __builtin_ctzll(blocked));
+            if (!might_get_dug_out(q, target, mine, opponents)) return false;
+        }
+        for (game_worm* it = mine; it != mine + 3; it++) {
+            if (!it->is_alive()) continue;
+            position cells[2] = { it->p, it->p + it->action.p };
+            for (uint8_t i = 0; i < (it->action.a == MOVE ? 2 : 1); i++) {
+                if (!on_board(cells[i])) continue;
+                if (rotated_layer<WIDTH>::line_of(cells[i], o) == line &&
+                    ray >> rotated_layer<WIDTH>::index_of(cells[i], o) & 1) return false;
+            }
         }
         return true;
     }
 
     void reset_actions() {
         for (game_worm* it = my_worms; it != my_worms + 3; it++) {
-            it->action = {};
+            set_action(it, {});
         }
         for (game_worm* it = opponent_worms; it != opponent_worms + 3; it++) {
-            it->action = {};
+            set_action(it, {});
+        }
+        for (uint8_t side = 0; side < 2; side++) {
+            if (!has_danger[side]) continue;
+            danger[side] = layer<WIDTH>();
+            has_danger[side] = false;
         }
     }
 
+    // Looks up the directions each enemy might be hit in from the shot table
+    // and keeps those whose line of fire might be clear.
     uint8_t shoot_candidates(game_worm w, game_worm* mine, game_worm* opponents) {
+        assert(range <= MAX_SHOT_RANGE);
         uint8_t result = 0;
         for (auto it = opponents; it < opponents + 3; it++) {
             game_worm other = *it;
-            double distance = euclidean_distance(w.p, other.p);
-            if (other.is_alive() && in_range(w.p, other.p)) {
-                if (might_shoot_north(w, other, mine, opponents)) {
-                    result |= N;
-                }
-                if (might_shoot_ne(w, other, distance, mine, opponents)) {
-                    result |= NE;
-                }
-                if (might_shoot_east(w, other, mine, opponents)) {
-                    result |= E;
-                }
-                if (might_shoot_se(w, other, distance, mine, opponents)) {
-                    result |= SE;
-                }
-                if (might_shoot_south(w, other, mine, opponents)) {
-                    result |= S;
-                }
-                if (might_shoot_sw(w, other, distance, mine, opponents)) {
-                    result |= SW;
-                }
-                if (might_shoot_west(w, other, mine, opponents)) {
-                    result |= W;
-                }
-                if (might_shoot_nw(w, other, distance, mine, opponents)) {
-                    result |= NW;
+            int8_t dx = other.p.x - w.p.x, dy = other.p.y - w.p.y;
+            if (!other.is_alive() || abs(dx) > STENCIL_REACH || abs(dy) > STENCIL_REACH) continue;
+            const shot_stencil& s = SHOT_TABLE.at(range, dx, dy);
+            for (uint8_t remaining = s.directions & ~result; remaining;
+                 remaining &= remaining - 1) {
+                uint8_t d = __builtin_ctz(remaining);
+                if (line_of_fire_clear(w.p, d, s.steps[d], other, mine, opponents)) {
+                    result |= 1 << d;
                 }
             }
         }
@@ -522,12 +691,41 @@ struct board {
     uint8_t range;
     uint8_t digging_range;
     layer<WIDTH> deep_space;
-    layer<WIDTH> air;
     layer<WIDTH> dirt;
     game_worm my_worms[3] = {};
     game_worm opponent_worms[3] = {};
     selected_action allocated_moves[3] = {};
+    // Positions of the living worms on each side, mine first.
+    layer<WIDTH> occupied[2];
+    // Cells worms on each side have chosen to move to this round.
+    layer<WIDTH> move_targets[2];
+    // Dirt each side mustn't dig this round, see add_shot_danger.
+    layer<WIDTH> danger[2];
+    // Dirt and deep space by column and diagonal, kept up to date by dig_cell.
+    rotated_layer<WIDTH> rotated_obstructions;
+    bool has_danger[2] = {};
+    uint64_t hash = 0;
+    // Rounds until the game is over, it isn't part of the hash.
+    uint16_t rounds_left = MAX_ROUNDS;
 
 };
 
+// Boards are instantiated for each map size the game is played on, and f is
+// called with a board for the state at the width given by its mapSize.
+template <uint8_t WIDTH>
+board<WIDTH> board_for(const game_state& state) {
+    board<WIDTH> result(state.map, state.myPlayer.worms, state.opponents.at(0).worms);
+    // The round in the state hasn't been played yet.
+    result.rounds_left = max(0, state.maxRounds - state.currentRound + 1);
+    return result;
+}
+
+template <typename F>
+auto with_board(const game_state& state, F f) {
+    switch (state.mapSize) {
+    case 33: return f(board_for<33>(state));
+    default: throw runtime_error("unsupported map size " + to_string(state.mapSize));
+    }
+}
+
 #endif
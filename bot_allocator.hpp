@@ -0,0 +1,103 @@
+#ifndef _BOT_ALLOCATOR_H_
+#define _BOT_ALLOCATOR_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+// Bump pointer arena for the search tree. The whole region is reserved up
+// front so that nothing in the search loop ever calls malloc, and the tree
+// is dropped in one go by calling reset at the start of a turn.
+struct bot_allocator {
+
+    static const uint64_t DEFAULT_CAPACITY = 1ULL << 29;
+    static const uint32_t ALIGNMENT = 16;
+
+    explicit bot_allocator(uint64_t capacity = DEFAULT_CAPACITY, bool huge_pages = false)
+        : capacity(round_up(capacity)) {
+        void* region = MAP_FAILED;
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#ifdef MAP_HUGETLB
+        if (huge_pages) {
+            region = mmap(nullptr, this->capacity, PROT_READ | PROT_WRITE,
+                          flags | MAP_HUGETLB, -1, 0);
+        }
+#endif
+        if (region == MAP_FAILED) {
+            region = mmap(nullptr, this->capacity, PROT_READ | PROT_WRITE, flags, -1, 0);
+            if (region == MAP_FAILED) {
+                throw runtime_error("failed to reserve arena");
+            }
+#ifdef MADV_HUGEPAGE
+            if (huge_pages) madvise(region, this->capacity, MADV_HUGEPAGE);
+#endif
+        }
+        base = reinterpret_cast<uint8_t*>(region);
+    }
+
+    ~bot_allocator() {
+        munmap(base, capacity);
+    }
+
+    bot_allocator(const bot_allocator&) = delete;
+    bot_allocator& operator=(const bot_allocator&) = delete;
+
+    static uint64_t round_up(uint64_t bytes) {
+        return (bytes + ALIGNMENT - 1) & ~(uint64_t)(ALIGNMENT - 1);
+    }
+
+    // Returns nullptr when the arena is exhausted, callers are expected to
+    // degrade gracefully (eg stop expanding the tree).
+    void* provide_bytes(uint32_t bytes) {
+        uint64_t size = round_up(bytes);
+        if (concurrent) {
+            uint64_t start = __atomic_fetch_add(&used, size, __ATOMIC_RELAXED);
+            return start + size <= capacity ? base + start : nullptr;
+        }
+        if (capacity - used < size) return nullptr;
+        void* result = base + used;
+        used += size;
+        if (used > high_water) high_water = used;
+        return result;
+    }
+
+    // Releases the most recent allocation of the given size.
+    void free_bytes(uint32_t bytes) {
+        uint64_t size = round_up(bytes);
+        used = size > used ? 0 : used - size;
+    }
+
+    // Moves everything allocated from offset onwards down to the start of
+    // the arena and frees the rest. Pointers into the moved bytes have to
+    // be written already adjusted by offset.
+    void keep_from(uint64_t offset) {
+        uint64_t size = bytes_used() - offset;
+        high_water = high_water_mark();
+        memmove(base, base + offset, size);
+        used = size;
+    }
+
+    void reset() {
+        high_water = high_water_mark();
+        used = 0;
+    }
+
+    uint64_t bytes_used() { return min(used, capacity); }
+    uint64_t high_water_mark() { return max(high_water, bytes_used()); }
+
+    uint8_t* base;
+    uint64_t capacity;
+    uint64_t used = 0;
+    uint64_t high_water = 0;
+    // Set when several threads share the arena. Only provide_bytes may then
+    // be called concurrently, and the high water mark is only brought up
+    // to date by reset.
+    bool concurrent = false;
+
+};
+
+#endif
@@ -62,6 +62,7 @@ struct my_player {
 struct game_state {
     int currentRound;
     int maxRounds;
+    int mapSize;
     int currentWormId;
     int consecutiveDoNothingCount;
     my_player myPlayer;
@@ -0,0 +1,101 @@
+#ifndef _DISTANCE_MAP_H_
+#define _DISTANCE_MAP_H_
+
+#include "board.hpp"
+#include <vector>
+
+using namespace std;
+
+const uint8_t UNREACHABLE = 255;
+// Rounds it takes to get into a cell of dirt, one to dig it and one to move.
+const uint8_t DIG_AND_MOVE = 2;
+
+// Rounds needed to reach every cell from a set of cells, moving in any of
+// the eight directions and ignoring worms. The search is breadth first a
+// whole frontier at a time: the cells first reached in d rounds are the
+// unreached air next to frontier d - 1, and when digging through is
+// allowed, the unreached dirt next to frontier d - 2. Each frontier is at
+// most a row further out than the last, so only that band of rows is
+// worked on. Only the frontiers are kept, the distance to a cell is looked
+// up in them.
+template <uint8_t WIDTH>
+struct distance_map {
+
+    // frontiers[d] holds the cells first reached in d rounds.
+    vector<layer<WIDTH>> frontiers;
+    layer<WIDTH> reached;
+
+    // The cells of row y next to or in one set in l.
+    static uint64_t spread(const layer<WIDTH>& l, int8_t y) {
+        uint64_t rows = l.padded_row(y - 1) | l.padded_row(y) | l.padded_row(y + 1);
+        return rows | rows << 1 | rows >> 1;
+    }
+
+    // The search stops once limit rounds out, cells further away are left
+    // unreached.
+    void compute(const board<WIDTH>& b, const layer<WIDTH>& sources, bool through_dirt,
+                 uint8_t limit = UNREACHABLE - 1) {
+        uint64_t open[WIDTH], diggable[WIDTH];
+        int8_t top = WIDTH, bottom = -1;
+        for (int8_t y = 0; y < WIDTH; y++) {
+            open[y] = b.air_row(y);
+            diggable[y] = through_dirt ? b.dirt.rows()[y] : 0;
+            if (sources.rows()[y]) {
+                top = min(top, y);
+                bottom = y;
+            }
+        }
+        frontiers.clear();
+        frontiers.push_back(sources);
+        reached = sources;
+        // Distances past UNREACHABLE - 1 don't fit, the cells beyond are
+        // left unreached, which only a maze of a map would need.
+        while (frontiers.size() <= limit) {
+            uint8_t d = frontiers.size();
+            top = max(0, top - 1);
+            bottom = min(WIDTH - 1, bottom + 1);
+            frontiers.emplace_back();
+            layer<WIDTH>& next = frontiers[d];
+            const layer<WIDTH>& last = frontiers[d - 1];
+            const layer<WIDTH>* dug = through_dirt && d >= DIG_AND_MOVE ?
+                &frontiers[d - DIG_AND_MOVE] : nullptr;
+            uint64_t any = 0;
+            for (int8_t y = top; y <= bottom; y++) {
+                uint64_t cells = spread(last, y) & open[y];
+                if (dug) cells |= spread(*dug, y) & diggable[y];
+                cells &= ~reached.rows()[y];
+                next.rows()[y] = cells;
+                reached.rows()[y] |= cells;
+                any |= cells;
+            }
+            // Dirt can still be reached from the last frontier when this one
+            // is empty, the search is over once two in a row are.
+            if (!any && (!through_dirt || last.empty())) break;
+        }
+        while (frontiers.size() > 1 && frontiers.back().empty()) frontiers.pop_back();
+    }
+
+    void compute(const board<WIDTH>& b, position source, bool through_dirt,
+                 uint8_t limit = UNREACHABLE - 1) {
+        layer<WIDTH> sources;
+        sources.set(source);
+        compute(b, sources, through_dirt, limit);
+    }
+
+    uint8_t distance(position p) const {
+        for (uint8_t d = 0; d < frontiers.size(); d++) {
+            if (frontiers[d].contains(p)) return d;
+        }
+        return UNREACHABLE;
+    }
+
+    // The cells reached in at most d rounds.
+    layer<WIDTH> within(uint8_t d) const {
+        layer<WIDTH> result;
+        for (uint8_t i = 0; i <= d && i < frontiers.size(); i++) result = result | frontiers[i];
+        return result;
+    }
+
+};
+
+#endif
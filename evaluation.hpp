@@ -0,0 +1,87 @@
+#ifndef _EVALUATION_H_
+#define _EVALUATION_H_
+
+#include "board.hpp"
+#include "distance_map.hpp"
+
+using namespace std;
+
+// A static score for positions that aren't over, positive when I'm ahead.
+// Every term is a difference between the two sides, in the same units as
+// worm health, and is worked out on whole layers at a time.
+struct evaluation_weights {
+    int32_t health = 1;
+    // For each worm with an enemy it could shoot right now.
+    int32_t shooter = 8;
+    // For each cell the side's worms could reach in mobility_steps moves.
+    int32_t mobility = 1;
+    uint8_t mobility_steps = 3;
+    // For each cell of dirt next to the side's worms, digging scores points.
+    int32_t dirt = 2;
+};
+
+inline int32_t living_health(const game_worm* worms) {
+    int32_t total = 0;
+    for (const game_worm* it = worms; it != worms + 3; it++) {
+        if (it->is_alive()) total += it->health;
+    }
+    return total;
+}
+
+template <uint8_t WIDTH>
+layer<WIDTH> living_positions(const game_worm* worms) {
+    layer<WIDTH> result;
+    for (const game_worm* it = worms; it != worms + 3; it++) {
+        if (it->is_alive()) result.set(it->p);
+    }
+    return result;
+}
+
+// Worms in mine with a living enemy in range and nothing but air between
+// them, worms in the way are ignored.
+template <uint8_t WIDTH>
+uint8_t shooters(const board<WIDTH>& b, const game_worm* mine, const game_worm* yours) {
+    uint8_t result = 0;
+    for (const game_worm* it = mine; it != mine + 3; it++) {
+        if (!it->is_alive()) continue;
+        for (const game_worm* other = yours; other != yours + 3; other++) {
+            if (!other->is_alive()) continue;
+            if (!b.within_weapon_range(it->p, other->p)) continue;
+            if (b.clear_line(it->p, other->p)) {
+                result++;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+// Cells the worms could walk to through air in at most steps moves,
+// ignoring other worms. The map is only scratch space, reusing one keeps
+// its frontiers from being allocated again.
+template <uint8_t WIDTH>
+uint32_t reachable_area(const board<WIDTH>& b, const game_worm* worms, uint8_t steps,
+                        distance_map<WIDTH>& map) {
+    // The search stops after steps rounds, so every cell it reached counts.
+    map.compute(b, living_positions<WIDTH>(worms), false, steps);
+    return map.reached.count();
+}
+
+template <uint8_t WIDTH>
+uint32_t dirt_nearby(const board<WIDTH>& b, const game_worm* worms) {
+    return (living_positions<WIDTH>(worms).dilate() & b.dirt).count();
+}
+
+template <uint8_t WIDTH>
+int32_t evaluate_board(const board<WIDTH>& b, distance_map<WIDTH>& map,
+                       const evaluation_weights& w = evaluation_weights()) {
+    const game_worm* mine = b.my_worms;
+    const game_worm* yours = b.opponent_worms;
+    return w.health * (living_health(mine) - living_health(yours)) +
+        w.shooter * (shooters(b, mine, yours) - shooters(b, yours, mine)) +
+        w.mobility * ((int32_t)reachable_area(b, mine, w.mobility_steps, map) -
+                      (int32_t)reachable_area(b, yours, w.mobility_steps, map)) +
+        w.dirt * ((int32_t)dirt_nearby(b, mine) - (int32_t)dirt_nearby(b, yours));
+}
+
+#endif
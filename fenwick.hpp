@@ -2,19 +2,17 @@
 #define _FENWICK_H
 
 #include <stdint.h>
+#include <string.h>
+#include "bot_allocator.hpp"
 
-struct bot_allocator {
-    void* provide_bytes(uint32_t bytes);
-    void free_bytes(uint32_t bytes);
-};
-
-uint32_t ls_one(uint32_t i) { return i & (-1); }
+inline uint32_t ls_one(uint32_t i) { return i & (-i); }
 
 struct fenwick {
 
     fenwick(uint16_t s, bot_allocator& a) {
         uint32_t* f = reinterpret_cast<uint32_t*>(a.provide_bytes((s + 1) * 4));
         if (f) {
+            memset(f, 0, (s + 1) * 4);
             total = 0;
             size = s;
             freq = f;
@@ -23,10 +21,12 @@ struct fenwick {
             size = 0;
             freq = nullptr;
         }
+        top_bit = size ? 1 << (31 - __builtin_clz(size)) : 0;
     }
 
     uint32_t total;
     uint16_t size;
+    uint16_t top_bit;
     uint32_t* freq;
 
     uint32_t operator[](uint16_t index) {
@@ -37,41 +37,39 @@ struct fenwick {
         int32_t total = 0;
         index++;
         while (index) {
-            total += freq[index];
+            total += __atomic_load_n(freq + index, __ATOMIC_RELAXED);
             index -= ls_one(index);
         }
         return total;
     }
 
+    // Updates are atomic adds so several threads can update the same tree.
+    // Additions commute so the tree is exact once they have all landed, a
+    // concurrent reader may see a partially applied update which only skews
+    // one sample. Negative values can be passed as their two's complement.
     void update(uint16_t index, uint32_t value) {
-        total += value;
+        __atomic_fetch_add(&total, value, __ATOMIC_RELAXED);
         index++;
         while (size >= index) {
-            freq[size] += value;
+            __atomic_fetch_add(freq + index, value, __ATOMIC_RELAXED);
             index += ls_one(index);
         }
     }
 
+    // Smallest index whose cumulative frequency exceeds target. Descends
+    // from the largest power of two so each level costs one lookup.
     uint16_t find_index(uint32_t target) {
-        uint16_t index = size / 2, bottom = 0, top = size;
-        uint32_t f = cumulative_frequency(index);
-        while (top - bottom > 1) {
-            if (f < target) {
-                bottom = index;
-                index = (bottom + top) / 2;
-            } else if (f > target) {
-                top = index;
-                index = (bottom + top) / 2;
-            } else {
-                return index;
+        uint16_t index = 0;
+        for (uint16_t step = top_bit; step; step >>= 1) {
+            uint16_t next = index + step;
+            if (next > size) continue;
+            uint32_t f = __atomic_load_n(freq + next, __ATOMIC_RELAXED);
+            if (f <= target) {
+                index = next;
+                target -= f;
             }
-            f = cumulative_frequency(index);
-        }
-        if (f < target) {
-            return index + 1;
-        } else {
-            return index;
         }
+        return index < size ? index : size - 1;
     }
 
 };
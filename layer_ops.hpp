@@ -0,0 +1,145 @@
+#ifndef _LAYER_OPS_H_
+#define _LAYER_OPS_H_
+
+#include <stdint.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Operations over whole layers, one word per row. The AVX2 versions work on
+// four rows at a time and are used when the compiler targets AVX2, the
+// scalar versions are always available so the two can be compared.
+
+inline void scalar_rows_or(uint64_t* out, const uint64_t* a, const uint64_t* b, uint8_t n) {
+    for (uint8_t i = 0; i < n; i++) out[i] = a[i] | b[i];
+}
+
+inline void scalar_rows_and(uint64_t* out, const uint64_t* a, const uint64_t* b, uint8_t n) {
+    for (uint8_t i = 0; i < n; i++) out[i] = a[i] & b[i];
+}
+
+// a & ~b
+inline void scalar_rows_and_not(uint64_t* out, const uint64_t* a, const uint64_t* b,
+                                uint8_t n) {
+    for (uint8_t i = 0; i < n; i++) out[i] = a[i] & ~b[i];
+}
+
+inline uint32_t scalar_rows_popcount(const uint64_t* a, uint8_t n) {
+    uint32_t result = 0;
+    for (uint8_t i = 0; i < n; i++) result += __builtin_popcountll(a[i]);
+    return result;
+}
+
+// Every cell set in a or 8-connected to one set in a, limited to the first
+// n rows and the columns in mask.
+inline void scalar_rows_dilate(uint64_t* out, const uint64_t* a, uint8_t n, uint64_t mask) {
+    uint64_t above = 0, row = a[0] | a[0] << 1 | a[0] >> 1;
+    for (uint8_t i = 0; i < n; i++) {
+        uint64_t below = i + 1 < n ? a[i + 1] | a[i + 1] << 1 | a[i + 1] >> 1 : 0;
+        out[i] = (above | row | below) & mask;
+        above = row;
+        row = below;
+    }
+}
+
+#ifdef __AVX2__
+
+inline void rows_or(uint64_t* out, const uint64_t* a, const uint64_t* b, uint8_t n) {
+    uint8_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_or_si256(x, y));
+    }
+    scalar_rows_or(out + i, a + i, b + i, n - i);
+}
+
+inline void rows_and(uint64_t* out, const uint64_t* a, const uint64_t* b, uint8_t n) {
+    uint8_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_and_si256(x, y));
+    }
+    scalar_rows_and(out + i, a + i, b + i, n - i);
+}
+
+inline void rows_and_not(uint64_t* out, const uint64_t* a, const uint64_t* b, uint8_t n) {
+    uint8_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_andnot_si256(y, x));
+    }
+    scalar_rows_and_not(out + i, a + i, b + i, n - i);
+}
+
+// Counts bits a nibble at a time with a shuffle lookup and sums the bytes
+// of each row with sad, as AVX2 has no vector popcount.
+inline uint32_t rows_popcount(const uint64_t* a, uint8_t n) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+    __m256i totals = _mm256_setzero_si256();
+    uint8_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i low = _mm256_shuffle_epi8(lookup, _mm256_and_si256(x, low_nibbles));
+        __m256i high = _mm256_shuffle_epi8(
+            lookup, _mm256_and_si256(_mm256_srli_epi16(x, 4), low_nibbles));
+        totals = _mm256_add_epi64(totals, _mm256_sad_epu8(_mm256_add_epi8(low, high),
+                                                          _mm256_setzero_si256()));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, totals);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + scalar_rows_popcount(a + i, n - i);
+}
+
+// Spreads each row sideways into a buffer with a zero row either side,
+// then ORs each row with its neighbours through loads offset by a row.
+inline void rows_dilate(uint64_t* out, const uint64_t* a, uint8_t n, uint64_t mask) {
+    uint64_t spread[66] = {0};
+    uint8_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i wide = _mm256_or_si256(x, _mm256_or_si256(_mm256_slli_epi64(x, 1),
+                                                          _mm256_srli_epi64(x, 1)));
+        _mm256_storeu_si256((__m256i*)(spread + 1 + i), wide);
+    }
+    for (; i < n; i++) spread[1 + i] = a[i] | a[i] << 1 | a[i] >> 1;
+    const __m256i columns = _mm256_set1_epi64x(mask);
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i above = _mm256_loadu_si256((const __m256i*)(spread + i));
+        __m256i row = _mm256_loadu_si256((const __m256i*)(spread + i + 1));
+        __m256i below = _mm256_loadu_si256((const __m256i*)(spread + i + 2));
+        __m256i result = _mm256_or_si256(above, _mm256_or_si256(row, below));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_and_si256(result, columns));
+    }
+    for (; i < n; i++) out[i] = (spread[i] | spread[i + 1] | spread[i + 2]) & mask;
+}
+
+#else
+
+inline void rows_or(uint64_t* out, const uint64_t* a, const uint64_t* b, uint8_t n) {
+    scalar_rows_or(out, a, b, n);
+}
+
+inline void rows_and(uint64_t* out, const uint64_t* a, const uint64_t* b, uint8_t n) {
+    scalar_rows_and(out, a, b, n);
+}
+
+inline void rows_and_not(uint64_t* out, const uint64_t* a, const uint64_t* b, uint8_t n) {
+    scalar_rows_and_not(out, a, b, n);
+}
+
+inline uint32_t rows_popcount(const uint64_t* a, uint8_t n) {
+    return scalar_rows_popcount(a, n);
+}
+
+inline void rows_dilate(uint64_t* out, const uint64_t* a, uint8_t n, uint64_t mask) {
+    scalar_rows_dilate(out, a, n, mask);
+}
+
+#endif
+
+#endif
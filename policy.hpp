@@ -0,0 +1,104 @@
+#ifndef _POLICY_H_
+#define _POLICY_H_
+
+#include "board.hpp"
+
+using namespace std;
+
+// Rollout policies pick each living worm's action in a rollout. They are
+// given the simulation so they can use its random numbers and helpers.
+
+// Draws a kind of action (move, dig or shoot) uniformly from those that are
+// available, then a direction uniformly.
+struct light_policy {
+
+    template <typename S>
+    selected_action select_action(S& s, game_worm w, game_worm* mine, game_worm* yours) {
+        return s.select_uniform_action(w, mine, yours);
+    }
+};
+
+struct heavy_policy_weights {
+    uint16_t move = 2;
+    // Added for a move that ends nearer the living enemies' centroid.
+    uint16_t move_closer = 4;
+    uint16_t dig = 2;
+    // Added for dirt between the worm and the enemies' centroid.
+    uint16_t dig_closer = 3;
+    uint16_t shoot = 1;
+    // Added for a shot at an enemy in range with nothing but air between.
+    uint16_t shoot_hits = 40;
+};
+
+// Weighs every available action by features read off the board's layers
+// and draws one in proportion to its weight.
+struct heavy_policy {
+
+    heavy_policy_weights weights;
+
+    // The direction bit index for a step of (dx, dy), each -1, 0 or 1.
+    static uint8_t direction_index(int8_t dx, int8_t dy) {
+        static const uint8_t indices[3][3] = {{7, 0, 1}, {6, 0, 2}, {5, 4, 3}};
+        return indices[dy + 1][dx + 1];
+    }
+
+    // Directions w could shoot in to hit an enemy right now.
+    template <uint8_t WIDTH>
+    static uint8_t hitting_shots(board<WIDTH>& b, game_worm w, game_worm* yours) {
+        uint8_t result = 0;
+        for (game_worm* it = yours; it != yours + 3; it++) {
+            if (!it->is_alive() || !b.within_weapon_range(w.p, it->p)) continue;
+            if (!b.clear_line(w.p, it->p)) continue;
+            int8_t dx = it->p.x - w.p.x, dy = it->p.y - w.p.y;
+            result |= 1 << direction_index((dx > 0) - (dx < 0), (dy > 0) - (dy < 0));
+        }
+        return result;
+    }
+
+    // Directions whose neighbouring cell is nearer target than p is.
+    static uint8_t closer_to(position p, position target) {
+        int32_t dx = target.x - p.x, dy = target.y - p.y;
+        int32_t here = dx * dx + dy * dy;
+        uint8_t result = 0;
+        for (uint8_t d = 0; d < 8; d++) {
+            int32_t x = dx - DIRECTION_DX[d], y = dy - DIRECTION_DY[d];
+            if (x * x + y * y < here) result |= 1 << d;
+        }
+        return result;
+    }
+
+    template <typename S>
+    selected_action select_action(S& s, game_worm w, game_worm* mine, game_worm* yours) {
+        auto& b = s.b;
+        uint8_t candidates[3] = { b.move_candidates(w, mine), b.dig_candidates(w, mine),
+                                  b.shoot_candidates(w, mine, yours) };
+        int16_t x = 0, y = 0, living = 0;
+        for (game_worm* it = yours; it != yours + 3; it++) {
+            if (!it->is_alive()) continue;
+            x += it->p.x;
+            y += it->p.y;
+            living++;
+        }
+        uint8_t closer = living ? closer_to(w.p, position(x / living, y / living)) : 0;
+        uint8_t favoured[3] = { closer, closer, hitting_shots(b, w, yours) };
+        const uint16_t base[3] = { weights.move, weights.dig, weights.shoot };
+        const uint16_t bonus[3] = { weights.move_closer, weights.dig_closer, weights.shoot_hits };
+        uint16_t cumulative[24];
+        uint16_t total = 0;
+        for (uint8_t kind = 0; kind < 3; kind++) {
+            for (uint8_t d = 0; d < 8; d++) {
+                if (candidates[kind] >> d & 1) {
+                    total += base[kind] + (favoured[kind] >> d & 1 ? bonus[kind] : 0);
+                }
+                cumulative[kind * 8 + d] = total;
+            }
+        }
+        if (!total) return s.select_safe_shot(w, mine);
+        uint16_t draw = s.rng.below(total);
+        uint8_t i = upper_bound(cumulative, cumulative + 24, draw) - cumulative;
+        static const action kinds[3] = { MOVE, DIG, SHOOT };
+        return s.select_action((direction)(1 << (i % 8)), kinds[i / 8]);
+    }
+};
+
+#endif
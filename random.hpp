@@ -0,0 +1,137 @@
+#ifndef _RANDOM_H_
+#define _RANDOM_H_
+
+#include <stdint.h>
+
+// Small state generators for rollouts. Each provides next32(), and
+// seed(seed, stream) so that threads sharing a seed draw from streams that
+// don't overlap.
+
+const uint64_t DEFAULT_SEED = 5489;
+
+inline uint64_t splitmix64(uint64_t& state) {
+    uint64_t x = (state += 0x9e3779b97f4a7c15ULL);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+inline uint64_t rotate_left(uint64_t x, uint8_t k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// xoshiro256** (Blackman and Vigna). Streams are 2^128 draws apart.
+struct xoshiro256 {
+
+    explicit xoshiro256(uint64_t seed_value = DEFAULT_SEED, uint64_t stream = 0) {
+        seed(seed_value, stream);
+    }
+
+    uint64_t s[4];
+
+    void seed(uint64_t seed_value, uint64_t stream = 0) {
+        for (uint8_t i = 0; i < 4; i++) s[i] = splitmix64(seed_value);
+        for (uint64_t i = 0; i < stream; i++) jump();
+    }
+
+    uint64_t next() {
+        uint64_t result = rotate_left(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotate_left(s[3], 45);
+        return result;
+    }
+
+    uint32_t next32() { return next() >> 32; }
+
+    // Advances by 2^128 draws.
+    void jump() {
+        static const uint64_t JUMP[4] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                          0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+        uint64_t t[4] = {};
+        for (uint64_t j : JUMP) {
+            for (uint8_t b = 0; b < 64; b++) {
+                if (j >> b & 1) {
+                    for (uint8_t i = 0; i < 4; i++) t[i] ^= s[i];
+                }
+                next();
+            }
+        }
+        for (uint8_t i = 0; i < 4; i++) s[i] = t[i];
+    }
+};
+
+// PCG32 (O'Neill), XSH RR output. Each stream is a different increment.
+struct pcg32 {
+
+    explicit pcg32(uint64_t seed_value = DEFAULT_SEED, uint64_t stream = 0) {
+        seed(seed_value, stream);
+    }
+
+    uint64_t state;
+    uint64_t increment;
+
+    void seed(uint64_t seed_value, uint64_t stream = 0) {
+        state = 0;
+        increment = stream << 1 | 1;
+        next32();
+        state += seed_value;
+        next32();
+    }
+
+    uint32_t next32() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + increment;
+        uint32_t shifted = ((old >> 18) ^ old) >> 27;
+        uint32_t rotation = old >> 59;
+        return (shifted >> rotation) | (shifted << ((-rotation) & 31));
+    }
+};
+
+// Draws are made SIZE at a time so the generator's loop runs without the
+// branches of the rollout policy between calls. below(n) is Lemire's
+// multiply and reject method, which is unbiased and rarely divides.
+template <typename RNG, uint16_t SIZE = 64>
+struct random_buffer {
+
+    explicit random_buffer(uint64_t seed_value = DEFAULT_SEED, uint64_t stream = 0)
+        : generator(seed_value, stream) {}
+
+    RNG generator;
+    uint32_t values[SIZE];
+    uint16_t next = SIZE;
+
+    void seed(uint64_t seed_value, uint64_t stream = 0) {
+        generator.seed(seed_value, stream);
+        next = SIZE;
+    }
+
+    void refill() {
+        for (uint16_t i = 0; i < SIZE; i++) values[i] = generator.next32();
+        next = 0;
+    }
+
+    uint32_t next32() {
+        if (next == SIZE) refill();
+        return values[next++];
+    }
+
+    uint32_t below(uint32_t n) {
+        uint64_t m = (uint64_t)next32() * n;
+        uint32_t low = m;
+        if (low < n) {
+            uint32_t threshold = -n % n;
+            while (low < threshold) {
+                m = (uint64_t)next32() * n;
+                low = m;
+            }
+        }
+        return m >> 32;
+    }
+};
+
+#endif
@@ -101,6 +101,7 @@ void from_json(const json& j, my_player& it) {
 void to_json(json& j, const game_state& it) {
     j["currentRound"] = it.currentRound;
     j["maxRounds"] = it.maxRounds;
+    j["mapSize"] = it.mapSize;
     j["currentWormId"] = it.currentWormId;
     j["consecutiveDoNothingCount"] = it.consecutiveDoNothingCount;
     j["myPlayer"] = it.myPlayer;
@@ -111,6 +112,7 @@ void to_json(json& j, const game_state& it) {
 void from_json(const json& j, game_state& it) {
     j.at("currentRound").get_to(it.currentRound);
     j.at("maxRounds").get_to(it.maxRounds);
+    j.at("mapSize").get_to(it.mapSize);
     j.at("currentWormId").get_to(it.currentWormId);
     j.at("consecutiveDoNothingCount").get_to(it.consecutiveDoNothingCount);
     j.at("myPlayer").get_to(it.myPlayer);
@@ -0,0 +1,138 @@
+#ifndef _SEARCH_H_
+#define _SEARCH_H_
+
+#include "tree.hpp"
+#include <thread>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+enum search_mode : uint8_t {
+    SINGLE_THREADED = 0,
+    ROOT_PARALLEL = 1,
+    TREE_PARALLEL = 2
+};
+
+struct search_config {
+    search_mode mode = SINGLE_THREADED;
+    uint8_t threads = 1;
+    uint64_t arena_bytes = bot_allocator::DEFAULT_CAPACITY;
+    chrono::milliseconds budget = chrono::milliseconds(900);
+    // Every thread draws from its own stream of this seed.
+    uint64_t seed = DEFAULT_SEED;
+    // Playouts are cut off this many rounds past the tree, and earlier if
+    // the game runs out of rounds.
+    uint16_t rollout_depth = MAX_ROLLOUT_STEPS;
+};
+
+// Owns the trees and arenas used to search a turn so they can be kept
+// between turns. In ROOT_PARALLEL mode every thread searches its own tree
+// from the same state and the visit counts of the root actions are summed
+// at the deadline. In TREE_PARALLEL mode the threads all descend one
+// shared tree, which grows deeper than the independent trees do.
+template <uint8_t WIDTH, typename POLICY = light_policy>
+struct searcher {
+
+    explicit searcher(search_config config) : config(config) {
+        if (config.mode == SINGLE_THREADED || config.threads == 0) this->config.threads = 1;
+    }
+
+    search_config config;
+    vector<unique_ptr<bot_allocator>> arenas;
+    vector<unique_ptr<tree<WIDTH, POLICY>>> trees;
+    search_stats stats;
+    // Set by each search so the next one can carry the trees forward.
+    moves played;
+    bool reuse_trees = true;
+    uint8_t reused_trees = 0;
+
+    void prepare(const board<WIDTH>& state) {
+        reused_trees = 0;
+        if (trees.empty()) {
+            uint8_t tree_count = config.mode == TREE_PARALLEL ? 1 : config.threads;
+            for (uint8_t i = 0; i < tree_count; i++) {
+                arenas.emplace_back(new bot_allocator(config.arena_bytes));
+                trees.emplace_back(new tree<WIDTH, POLICY>(arenas.back().get(), state,
+                                                           config.seed, i));
+                arenas.back()->concurrent = config.mode == TREE_PARALLEL;
+                trees.back()->use_transpositions = config.mode != TREE_PARALLEL;
+                trees.back()->rollout_depth = config.rollout_depth;
+            }
+        }
+        for (auto& t : trees) {
+            if (reuse_trees) {
+                reused_trees += t->advance_root(state, played);
+            } else {
+                t->current_state = state;
+                t->root = nullptr;
+            }
+        }
+    }
+
+    moves merge_root_visits() {
+        uint64_t visits[3][ACTIONS_PER_WORM] = {};
+        for (auto& t : trees) {
+            if (!t->root) continue;
+            for (uint8_t w = 0; w < 3; w++) {
+                for (uint8_t i = 0; i < ACTIONS_PER_WORM; i++) {
+                    visits[w][i] += t->root->visits[w * ACTIONS_PER_WORM + i];
+                }
+            }
+        }
+        moves result;
+        for (uint8_t w = 0; w < 3; w++) {
+            uint8_t best = max_element(visits[w], visits[w] + ACTIONS_PER_WORM) - visits[w];
+            result.actions[w] = action_from_index(best);
+        }
+        return result;
+    }
+
+    moves search(const board<WIDTH>& state) {
+        prepare(state);
+        auto start = chrono::steady_clock::now();
+        if (config.mode == TREE_PARALLEL) {
+            return search_shared_tree(start);
+        }
+        if (trees.size() == 1) {
+            trees[0]->search(config.budget);
+        } else {
+            vector<thread> workers;
+            for (auto& t : trees) {
+                tree<WIDTH, POLICY>* current = t.get();
+                chrono::milliseconds budget = config.budget;
+                workers.emplace_back([current, budget]() { current->search(budget); });
+            }
+            for (auto& w : workers) w.join();
+        }
+        stats = search_stats();
+        stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        for (auto& t : trees) stats.playouts += t->stats.playouts;
+        played = merge_root_visits();
+        return played;
+    }
+
+    moves search_shared_tree(chrono::steady_clock::time_point start) {
+        tree<WIDTH, POLICY>* shared = trees[0].get();
+        if (!shared->root) shared->reset_root();
+        auto deadline = start + config.budget;
+        vector<uint64_t> playouts(config.threads);
+        vector<thread> workers;
+        for (uint8_t i = 0; i < config.threads; i++) {
+            uint64_t* count = &playouts[i];
+            workers.emplace_back([shared, deadline, i, count]() {
+                *count = shared->search_shared(deadline, i);
+            });
+        }
+        for (auto& w : workers) w.join();
+        stats = search_stats();
+        stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        for (uint64_t p : playouts) stats.playouts += p;
+        shared->stats = stats;
+        played = merge_root_visits();
+        return played;
+    }
+
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef _SHOT_TABLE_H_
+#define _SHOT_TABLE_H_
+
+#include <stdint.h>
+
+const uint8_t MAX_SHOT_RANGE = 8;
+const int8_t STENCIL_REACH = MAX_SHOT_RANGE + 2;
+const uint8_t STENCIL_WIDTH = 2 * STENCIL_REACH + 1;
+
+// Offsets for the eight directions in the order of the direction bits
+// (N, NE, E, SE, S, SW, W, NW).
+const int8_t DIRECTION_DX[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+const int8_t DIRECTION_DY[8] = { -1, -1, 0, 1, 1, 1, 0, -1 };
+
+// For a target at some offset from the shooter, the directions in which a
+// shot might hit it (the target is in range and at most one move away from
+// the line of fire) and how many cells of each line of fire have to be
+// clear for the shot to get there.
+struct shot_stencil {
+    uint8_t directions;
+    uint8_t steps[8];
+};
+
+struct shot_table {
+    shot_stencil stencils[MAX_SHOT_RANGE + 1][STENCIL_WIDTH][STENCIL_WIDTH];
+    // Largest squared distance a target can be at for each range, see
+    // in_range_threshold.
+    int32_t in_range[MAX_SHOT_RANGE + 1];
+
+    const shot_stencil& at(uint8_t range, int8_t dx, int8_t dy) const {
+        return stencils[range][dy + STENCIL_REACH][dx + STENCIL_REACH];
+    }
+};
+
+constexpr int32_t integer_sqrt(int32_t n) {
+    int32_t result = 0;
+    while ((result + 1) * (result + 1) <= n) result++;
+    return result;
+}
+
+// Largest squared distance within range + sqrt(2), the furthest a target
+// can be and still step into range.
+constexpr int32_t in_range_threshold(int32_t range) {
+    return range * range + 2 + integer_sqrt(8 * range * range);
+}
+
+constexpr int8_t absolute(int8_t value) { return value < 0 ? -value : value; }
+
+constexpr shot_table make_shot_table() {
+    shot_table table{};
+    for (int32_t range = 0; range <= MAX_SHOT_RANGE; range++) {
+        table.in_range[range] = in_range_threshold(range);
+        for (int8_t dy = -STENCIL_REACH; dy <= STENCIL_REACH; dy++) {
+            for (int8_t dx = -STENCIL_REACH; dx <= STENCIL_REACH; dx++) {
+                shot_stencil& s = table.stencils[range][dy + STENCIL_REACH][dx + STENCIL_REACH];
+                int32_t squared = dx * dx + dy * dy;
+                if (squared > table.in_range[range]) continue;
+                int32_t limit = squared < range * range ? squared : range * range;
+                uint8_t diagonal_steps = 0;
+                while (2 * (diagonal_steps + 1) * (diagonal_steps + 1) <= limit) diagonal_steps++;
+                uint8_t vertical_steps = absolute(dy) < range ? absolute(dy) : range;
+                uint8_t horizontal_steps = absolute(dx) < range ? absolute(dx) : range;
+                bool near_column = absolute(dx) <= 1, near_row = absolute(dy) <= 1;
+                bool near_diagonal = absolute(dy - dx) <= 1;
+                bool near_anti_diagonal = absolute(dx + dy) <= 1;
+                bool candidates[8] = { near_column && dy <= 0, near_anti_diagonal && dx >= 0,
+                                       near_row && dx >= 0, near_diagonal && dx >= 0,
+                                       near_column && dy >= 0, near_anti_diagonal && dx <= 0,
+                                       near_row && dx <= 0, near_diagonal && dx <= 0 };
+                uint8_t steps[8] = { vertical_steps, diagonal_steps, horizontal_steps,
+                                     diagonal_steps, vertical_steps, diagonal_steps,
+                                     horizontal_steps, diagonal_steps };
+                for (uint8_t d = 0; d < 8; d++) {
+                    if (!candidates[d]) continue;
+                    s.directions |= 1 << d;
+                    s.steps[d] = steps[d];
+                }
+            }
+        }
+    }
+    return table;
+}
+
+inline constexpr shot_table SHOT_TABLE = make_shot_table();
+
+#endif
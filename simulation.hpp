@@ -2,7 +2,12 @@
 #define _SIMULATION_H_
 
 #include "board.hpp"
-#include <random>
+#include "random.hpp"
+#include "evaluation.hpp"
+#include "policy.hpp"
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -16,38 +21,101 @@ enum result_score : uint8_t {
     I_WIN = 2
 };
 
-template<uint8_t WIDTH>
+const uint8_t ACTIONS_PER_WORM = 25;
+const uint8_t ACTION_BITS = 5;
+
+// Actions for a single worm are indexed with 0 for doing nothing followed
+// by moving, digging and shooting in each of the eight directions.
+inline uint8_t action_index(selected_action s) {
+    if (s.a == NOTHING) return 0;
+    uint8_t kind = s.a == MOVE ? 0 : s.a == DIG ? 1 : 2;
+    static const uint8_t direction_offsets[3][3] = {{7, 0, 1}, {6, 0, 2}, {5, 4, 3}};
+    return 1 + kind * 8 + direction_offsets[s.p.y + 1][s.p.x + 1];
+}
+
+inline selected_action action_from_index(uint8_t index) {
+    static const position offsets[8] = { {0, -1}, {1, -1}, {1, 0}, {1, 1},
+                                         {0, 1}, {-1, 1}, {-1, 0}, {-1, -1} };
+    static const action kinds[3] = { MOVE, DIG, SHOOT };
+    selected_action result;
+    if (index == 0) return result;
+    result.p = offsets[(index - 1) % 8];
+    result.a = kinds[(index - 1) / 8];
+    return result;
+}
+
+inline uint8_t joint_action_part(uint32_t key, uint8_t worm) {
+    return (key >> (worm * ACTION_BITS)) & ((1 << ACTION_BITS) - 1);
+}
+
+struct set_bit_table {
+    uint8_t positions[256][8];
+};
+
+constexpr set_bit_table make_set_bit_table() {
+    set_bit_table table{};
+    for (uint16_t mask = 0; mask < 256; mask++) {
+        uint8_t count = 0;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            if (mask >> bit & 1) table.positions[mask][count++] = bit;
+        }
+    }
+    return table;
+}
+
+inline constexpr set_bit_table SET_BIT_TABLE = make_set_bit_table();
+
+// The n-th (from 0) lowest set bit of mask, which must have more than n
+// bits set. pdep deposits a single bit into the n-th set position of mask
+// where BMI2 is available, otherwise the position is looked up.
+inline uint8_t nth_set_bit(uint8_t mask, uint8_t n) {
+#ifdef __BMI2__
+    return _pdep_u32(1U << n, mask);
+#else
+    return 1 << SET_BIT_TABLE.positions[mask][n];
+#endif
+}
+
+// Rollouts stop after this many rounds unless told otherwise, and the
+// position they reach is scored as it stands.
+const uint16_t MAX_ROLLOUT_STEPS = 200;
+
+// Damage both worms take when they move into the same cell, the game's
+// pushback damage, whatever the weapon does.
+const uint8_t COLLISION_DAMAGE = 20;
+
+template<uint8_t WIDTH, typename RNG = xoshiro256, typename POLICY = light_policy>
 struct simulation {
 
     board<WIDTH> b;
-    mt19937 mt;
+    random_buffer<RNG> rng;
+    evaluation_weights weights;
+    // Scratch space for evaluate.
+    distance_map<WIDTH> distances;
+    POLICY policy;
 
-    explicit simulation(board<WIDTH> b) : b(b) {}
+    explicit simulation(board<WIDTH> b) : b(b) {
+        this->b.refresh();
+    }
 
     direction select_direction(uint8_t available) {
-        uint8_t set_bits = __builtin_popcount(available);
-        uint8_t selected_bit = mt() % set_bits;
-        for (uint8_t i = 0; i < 8; i++) {
-            uint8_t current_bit = set_bits & 1 << i;
-            if (current_bit && selected_bit == 0) return (direction)current_bit;
-            else if (current_bit) {
-                selected_bit--;
-            }
-            assert(false);
-        }
+        if (!available) return NONE;
+        return (direction)nth_set_bit(available, rng.below(__builtin_popcount(available)));
     }
 
     selected_action select_safe_shot(game_worm me, game_worm* mine) {
         uint8_t options = NE | NW | SE | SW;
         for (game_worm* it = mine; it != mine + 3; it++) {
             game_worm w = *it;
+            if (!w.is_alive() || w.p == me.p) continue;
             position p = w.action.a == MOVE ? w.p + w.action.p : w.p;
             if (p.x > me.p.x && p.y < me.p.y) options ^= NE;
             else if (p.x < me.p.x && p.y < me.p.y) options ^= NW;
             else if (p.x > me.p.x && p.y > me.p.y) options ^= SE;
             else if (p.x < me.p.x && p.y > me.p.y) options ^= SW;
         }
-        return selected_action(select_direction(options), SHOOT);
+        if (!options) return {};
+        return select_action(select_direction(options), SHOOT);
     }
 
     selected_action select_action(direction direction, action a) {
@@ -74,13 +142,18 @@ struct simulation {
         }
     }
 
+    // The rollout policy's choice for w.
     selected_action select_action(game_worm w, game_worm* mine, game_worm* yours) {
+        return policy.select_action(*this, w, mine, yours);
+    }
+
+    selected_action select_uniform_action(game_worm w, game_worm* mine, game_worm* yours) {
 
         uint8_t move_candidates = b.move_candidates(w, mine);
-        uint8_t dig_candidates = b.dig_candidates(w, mine, yours);
+        uint8_t dig_candidates = b.dig_candidates(w, mine);
         uint8_t shoot_candidates = b.shoot_candidates(w, mine, yours);
         if (move_candidates && dig_candidates && shoot_candidates) {
-            uint8_t draw = mt() % 3;
+            uint8_t draw = rng.below(3);
             if (draw == 0) {
                 direction d = select_direction(move_candidates);
                 return select_action(d, MOVE);
@@ -93,7 +166,7 @@ struct simulation {
             }
         }
         if (move_candidates && dig_candidates) {
-            uint8_t draw = mt() % 2;
+            uint8_t draw = rng.below(2);
             if (draw == 0) {
                 direction d = select_direction(move_candidates);
                 return select_action(d, MOVE);
@@ -103,7 +176,7 @@ struct simulation {
             }
         }
         if (move_candidates && shoot_candidates) {
-            uint8_t draw = mt() % 2;
+            uint8_t draw = rng.below(2);
             if (draw == 0) {
                 direction d = select_direction(move_candidates);
                 return select_action(d, MOVE);
@@ -113,7 +186,7 @@ struct simulation {
             }
         }
         if (dig_candidates && shoot_candidates) {
-            uint8_t draw = mt() % 2;
+            uint8_t draw = rng.below(2);
             if (draw == 0) {
                 direction d = select_direction(dig_candidates);
                 return select_action(d, DIG);
@@ -134,51 +207,75 @@ struct simulation {
             direction d = select_direction(shoot_candidates);
             return select_action(d, SHOOT);
         }
-        return b.select_safe_shot(w, mine, yours);
+        return select_safe_shot(w, mine);
     }
 
     void move(game_worm* wrm) {
         game_worm w = *wrm;
         assert(w.action.a == MOVE);
         assert(!b.obstructed(w.p + w.action.p));
-        w.p += w.action.p;
-        *wrm = w;
+        b.set_action(wrm, {});
+        b.move_worm(wrm, w.p + w.action.p);
     }
 
     void dig(game_worm w) {
-        position dirt_position = w.p + w.action.p;
-        b.dirt.rows[dirt_position.y] ^= 1ULL << dirt_position.x;
+        b.dig_cell(w.p + w.action.p);
     }
 
-    bool hit_friendly(position p, game_worm* mine) {
-        for (game_worm* it = mine; it != mine + 3; it++) {
-            game_worm w = *it;
-            if (w.is_alive() && p == w.p) {
-                w.health -= b.damage;
+    // The worm is only looked for once the occupancy layer says one is there.
+    bool hit_worm(position p, game_worm* worms) {
+        if (!b.occupied[b.side_of(worms)].contains(p)) return false;
+        for (game_worm* it = worms; it != worms + 3; it++) {
+            if (it->is_alive() && p == it->p) {
+                b.damage_worm(it, b.damage);
                 return true;
             }
         }
         return false;
     }
 
+    bool hit_friendly(position p, game_worm* mine) {
+        return hit_worm(p, mine);
+    }
+
     bool hit_enemy(position p, game_worm* enemies) {
-        for (game_worm* it = enemies; it != enemies + 3; it++) {
-            game_worm enemy = *it;
-            if (enemy.is_alive() && p == enemy.p) {
-                enemy.health -= b.damage;
-                return true;
-            }
-        }
-        return false;
+        return hit_worm(p, enemies);
+    }
+
+    bool on_board(position p) {
+        return b.on_board(p);
     }
 
     void shoot(game_worm w, game_worm* mine, game_worm* enemies) {
         assert(w.action.a == SHOOT);
         position p = w.p + w.action.p;
-        while (b.in_range(w.p, p)) {
+        while (on_board(p) && b.within_weapon_range(w.p, p)) {
             if (b.obstructed(p)) return;
             if (hit_enemy(p, enemies)) return;
             if (hit_friendly(p, mine)) return;
+            p += w.action.p;
+        }
+    }
+
+    // Worms from opposing sides moving into the same cell both take damage,
+    // then swap places or stay where they are with equal probability.
+    void resolve_collisions() {
+        for (game_worm* mine = b.my_worms; mine != b.my_worms + 3; mine++) {
+            if (mine->action.a != MOVE) continue;
+            for (game_worm* yours = b.opponent_worms; yours != b.opponent_worms + 3; yours++) {
+                if (yours->action.a != MOVE) continue;
+                if (!(mine->p + mine->action.p == yours->p + yours->action.p)) continue;
+                b.damage_worm(mine, COLLISION_DAMAGE);
+                b.damage_worm(yours, COLLISION_DAMAGE);
+                b.set_action(mine, {});
+                b.set_action(yours, {});
+                if (rng.below(2) && mine->is_alive() && yours->is_alive()) {
+                    position p = mine->p;
+                    b.move_worm(mine, yours->p);
+                    b.move_worm(yours, p);
+                }
+                break;
+            }
         }
     }
 
@@ -201,20 +298,21 @@ struct simulation {
     void apply_digs(game_worm* mine, game_worm* yours) {
         for (game_worm* it = mine; it != mine + 3; it++) {
             if (it->action.a == DIG) {
-                shoot(*it, mine, yours);
+                dig(*it);
             }
         }
     }
 
     void select_actions(game_worm* mine, game_worm* yours) {
         for (game_worm* it = mine; it != mine + 3; it++) {
-            if (it->is_alive()) it->action = select_action(*it, mine, yours);
+            if (!it->is_alive()) continue;
+            b.set_action(it, select_action(*it, mine, yours));
+            if (it->action.a == SHOOT) b.add_shot_danger(*it, mine, yours);
         }
     }
 
-    void step() {
-        select_actions(b.my_worms, b.opponent_worms);
-        select_actions(b.opponent_worms, b.my_worms);
+    void apply_actions() {
+        resolve_collisions();
         apply_moves(b.my_worms);
         apply_moves(b.opponent_worms);
         apply_digs(b.my_worms, b.opponent_worms);
@@ -222,6 +320,45 @@ struct simulation {
         apply_shots(b.my_worms, b.opponent_worms);
         apply_shots(b.opponent_worms, b.my_worms);
         b.reset_actions();
+        if (b.rounds_left) b.rounds_left--;
+    }
+
+    void step() {
+        select_actions(b.my_worms, b.opponent_worms);
+        select_actions(b.opponent_worms, b.my_worms);
+        apply_actions();
+    }
+
+    // Sets every worm's action from a joint action key (see action_index)
+    // and plays out the round. Each worm's part of the key is chosen on its
+    // own, so two worms on a side can pick the same cell to move to; the
+    // second of them stays where it is.
+    void apply_joint_action(uint32_t key) {
+        for (uint8_t i = 0; i < 6; i++) {
+            game_worm& w = worm_at(i);
+            selected_action a = w.is_alive() ? action_from_index(joint_action_part(key, i)) :
+                selected_action();
+            if (a.a == MOVE && b.on_board(w.p + a.p) &&
+                b.move_targets[i < 3 ? 0 : 1].contains(w.p + a.p)) {
+                a = selected_action();
+            }
+            b.set_action(&w, a);
+        }
+        apply_actions();
+    }
+
+    game_worm& worm_at(uint8_t i) {
+        return i < 3 ? b.my_worms[i] : b.opponent_worms[i - 3];
+    }
+
+    // Bit i of the result is set when action_from_index(i) is available to
+    // the worm, doing nothing is only offered when nothing else is.
+    uint32_t action_candidates(game_worm w, game_worm* mine, game_worm* yours) {
+        if (!w.is_alive()) return 1;
+        uint32_t result = (uint32_t)b.move_candidates(w, mine) << 1 |
+            (uint32_t)b.dig_candidates(w, mine) << 9 |
+            (uint32_t)b.shoot_candidates(w, mine, yours) << 17;
+        return result ? result : 1;
     }
 
     bool is_dead(game_worm* player) {
@@ -233,17 +370,32 @@ struct simulation {
     }
 
     bool game_has_finished() {
-        return is_dead(b.my_worms) || is_dead(b.opponent_worms);
+        return is_dead(b.my_worms) || is_dead(b.opponent_worms) || !b.rounds_left;
+    }
+
+    // Plays until the game is over or max_steps rounds have been played,
+    // returns the number of rounds played.
+    uint16_t rollout(uint16_t max_steps = MAX_ROLLOUT_STEPS) {
+        uint16_t i = 0;
+        for (; i < max_steps && !game_has_finished(); i++) step();
+        return i;
     }
 
-    void rollout() {
-        while (!game_has_finished()) step();
+    // How far ahead I am in a position that isn't over.
+    int32_t evaluate() {
+        return evaluate_board(b, distances, weights);
     }
 
+    // Games that haven't finished, because a rollout was cut off or the
+    // rounds ran out, are decided by evaluate.
     result_score determine_score() {
-        if (is_dead(b.my_worms())) return YOU_WIN;
-        if (is_dead(b.opponent_worms())) return I_WIN;
-        assert(false);
+        bool i_am_dead = is_dead(b.my_worms);
+        bool you_are_dead = is_dead(b.opponent_worms);
+        if (i_am_dead && !you_are_dead) return YOU_WIN;
+        if (you_are_dead && !i_am_dead) return I_WIN;
+        int32_t difference = evaluate();
+        if (difference > 0) return I_WIN;
+        if (difference < 0) return YOU_WIN;
         return DRAW;
     }
 
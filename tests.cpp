@@ -2,6 +2,11 @@
 #include "read_data.hpp"
 #include "board.hpp"
 #include "simulation.hpp"
+#include "bot_allocator.hpp"
+#include "tree.hpp"
+#include "search.hpp"
+#include "distance_map.hpp"
+#include <set>
 
 using namespace std;
 
@@ -13,6 +18,7 @@ TEST(read_data, reads_expected_player) {
 
     ASSERT_EQ(s.currentRound, 50);
     ASSERT_EQ(s.maxRounds, 200);
+    ASSERT_EQ(s.mapSize, 33);
     ASSERT_EQ(s.currentWormId, 1);
     ASSERT_EQ(s.consecutiveDoNothingCount, 10);
     
@@ -89,21 +95,55 @@ TEST(layer, is_correctly_constructed_from_map) {
 
     layer<2> air(map, "AIR");
     
-    ASSERT_EQ(air.rows[0], 0);
-    ASSERT_EQ(air.rows[1], 3);
+    ASSERT_EQ(air.rows()[0], 0);
+    ASSERT_EQ(air.rows()[1], 3);
 
     layer<2> dirt(map, "DIRT");
 
-    ASSERT_EQ(dirt.rows[0], 2);
-    ASSERT_EQ(dirt.rows[1], 0);
+    ASSERT_EQ(dirt.rows()[0], 2);
+    ASSERT_EQ(dirt.rows()[1], 0);
 
     layer<2> deep_space(map, "DEEP_SPACE");
 
-    ASSERT_EQ(deep_space.rows[0], 1);
-    ASSERT_EQ(deep_space.rows[1], 0);
+    ASSERT_EQ(deep_space.rows()[0], 1);
+    ASSERT_EQ(deep_space.rows()[1], 0);
 
 }
 
+TEST(layer, whole_layer_operations_match_a_cell_by_cell_check) {
+
+    mt19937_64 mt(41);
+    for (int trial = 0; trial < 50; trial++) {
+        layer<33> a, b;
+        for (int y = 0; y < 33; y++) {
+            a.rows()[y] = mt() & mt() & ((1ULL << 33) - 1);
+            b.rows()[y] = mt() & ((1ULL << 33) - 1);
+        }
+        layer<33> either = a | b, both = a & b, only_a = a.and_not(b), grown = a.dilate();
+        uint32_t count = 0;
+        for (int8_t y = 0; y < 33; y++) {
+            for (int8_t x = 0; x < 33; x++) {
+                position p(x, y);
+                ASSERT_EQ(either.contains(p), a.contains(p) || b.contains(p));
+                ASSERT_EQ(both.contains(p), a.contains(p) && b.contains(p));
+                ASSERT_EQ(only_a.contains(p), a.contains(p) && !b.contains(p));
+                bool near = false;
+                for (int8_t dy = -1; dy <= 1; dy++) {
+                    for (int8_t dx = -1; dx <= 1; dx++) {
+                        position q(x + dx, y + dy);
+                        if (q.x < 0 || q.x >= 33 || q.y < 0 || q.y >= 33) continue;
+                        near |= a.contains(q);
+                    }
+                }
+                ASSERT_EQ(grown.contains(p), near);
+                count += a.contains(p);
+            }
+            ASSERT_EQ(grown.rows()[y] >> 33, 0ULL);
+        }
+        ASSERT_EQ(a.count(), count);
+    }
+}
+
 TEST(board, is_correctly_constructed_from_map) {
 
     vector<vector<cell>> map = {{ {0, 1, "AIR"}, {1, 0, "DIRT" }}, 
@@ -120,17 +160,17 @@ TEST(board, is_correctly_constructed_from_map) {
     ASSERT_EQ(b.range, 13);
     ASSERT_EQ(b.digging_range, 3);
 
-    layer<2>& air = b.air;
-    ASSERT_EQ(air.rows[0], 0);
-    ASSERT_EQ(air.rows[1], 3);
+    layer<2> air = b.air();
+    ASSERT_EQ(air.rows()[0], 0);
+    ASSERT_EQ(air.rows()[1], 3);
 
     layer<2>& dirt = b.dirt;
-    ASSERT_EQ(dirt.rows[0], 2);
-    ASSERT_EQ(dirt.rows[1], 0);
+    ASSERT_EQ(dirt.rows()[0], 2);
+    ASSERT_EQ(dirt.rows()[1], 0);
 
     layer<2>& deep_space = b.deep_space;
-    ASSERT_EQ(deep_space.rows[0], 1);
-    ASSERT_EQ(deep_space.rows[1], 0);
+    ASSERT_EQ(deep_space.rows()[0], 1);
+    ASSERT_EQ(deep_space.rows()[1], 0);
 
     game_worm mw = b.my_worms[0];
     ASSERT_EQ(mw.p.x, 0);
@@ -163,6 +203,69 @@ TEST(board, when_all_squares_are_available_all_directions_are_move_candidates) {
     ASSERT_EQ((int)b.move_candidates(b.my_worms[0], b.my_worms), 255);
 }
 
+TEST(board, friendly_worms_and_their_move_targets_are_not_move_candidates) {
+
+    uint64_t air_rows[9] = { 511, 511, 511, 511, 511, 511, 511, 511, 511 };
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 6, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(0, 8, 5);
+    b.my_worms[1] = game_worm(1, 7, 5);
+    b.my_worms[2] = game_worm(2, 8, 5);
+    b.refresh();
+
+    ASSERT_EQ((int)b.move_candidates(b.my_worms[0], b.my_worms), N | E);
+
+    b.set_action(&b.my_worms[2], { { -1, 0 }, MOVE });
+
+    ASSERT_EQ((int)b.move_candidates(b.my_worms[0], b.my_worms), N);
+}
+
+TEST(board, move_candidates_match_a_cell_by_cell_check) {
+
+    mt19937 mt(11);
+    for (int trial = 0; trial < 200; trial++) {
+        uint64_t air_rows[9], dirt_rows[9], deep_space_rows[9];
+        for (int y = 0; y < 9; y++) {
+            air_rows[y] = mt() & 511;
+            dirt_rows[y] = ~air_rows[y] & 511;
+            deep_space_rows[y] = 0;
+        }
+
+        layer<9> air(air_rows);
+        layer<9> dirt(dirt_rows);
+        layer<9> deep_space(deep_space_rows);
+
+        board<9> b(dirt, air, deep_space, 4, 2, 1);
+
+        for (int i = 0; i < 3; i++) {
+            b.my_worms[i] = game_worm(mt() % 9, mt() % 9, mt() % 3);
+            b.opponent_worms[i] = game_worm(mt() % 9, mt() % 9, 5);
+        }
+        b.refresh();
+        b.set_action(&b.my_worms[1], action_from_index(mt() % ACTIONS_PER_WORM));
+
+        game_worm w = b.my_worms[0];
+        uint8_t expected = 0;
+        for (uint8_t d = 1; d; d <<= 1) {
+            position p = w.p + board<9>::direction_offset(d);
+            if (p.x < 0 || p.x >= 9 || p.y < 0 || p.y >= 9) continue;
+            if (!(air_rows[p.y] >> p.x & 1)) continue;
+            if (!b.safe_to_move_to(b.my_worms, p)) continue;
+            expected |= d;
+        }
+        ASSERT_EQ((int)b.move_candidates(w, b.my_worms), (int)expected);
+    }
+}
+
 TEST(board, when_all_surrounding_squares_are_dirt_all_directions_are_dig_candidates) {
 
     uint64_t air_rows[9] = {0, 0, 4, 0, 0, 0, 0, 0, 0};
@@ -179,10 +282,76 @@ TEST(board, when_all_surrounding_squares_are_dirt_all_directions_are_dig_candida
 
     b.my_worms[0] = game_worm(2, 2, 5);
 
-    ASSERT_EQ((int)b.dig_candidates(b.my_worms[0], b.my_worms, b.opponent_worms), 255);
+    ASSERT_EQ((int)b.dig_candidates(b.my_worms[0], b.my_worms), 255);
 
 }
 
+TEST(board, digging_dirt_that_would_let_a_shot_hit_a_friend_is_not_a_dig_candidate) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    air_rows[3] = 511 ^ 16;
+    dirt_rows[3] = 16;
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 3, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(4, 5, 5);
+    b.my_worms[1] = game_worm(4, 1, 5);
+    b.my_worms[2] = game_worm(5, 3, 5);
+    b.opponent_worms[0] = game_worm(3, 3, 5);
+    b.refresh();
+
+    ASSERT_EQ((int)b.dig_candidates(b.my_worms[2], b.my_worms), W);
+
+    b.my_worms[0].action = { { 0, -1 }, SHOOT };
+    b.add_shot_danger(b.my_worms[0], b.my_worms, b.opponent_worms);
+
+    ASSERT_EQ((int)b.dig_candidates(b.my_worms[2], b.my_worms), NONE);
+    ASSERT_EQ((int)b.dig_candidates(b.opponent_worms[0], b.opponent_worms), E);
+
+    b.reset_actions();
+
+    ASSERT_EQ((int)b.dig_candidates(b.my_worms[2], b.my_worms), W);
+
+    b.opponent_worms[1] = game_worm(4, 2, 5);
+    b.refresh();
+    b.my_worms[0].action = { { 0, -1 }, SHOOT };
+    b.add_shot_danger(b.my_worms[0], b.my_worms, b.opponent_worms);
+
+    ASSERT_EQ((int)b.dig_candidates(b.my_worms[2], b.my_worms), W);
+}
+
+TEST(board, is_instantiated_for_the_map_size_of_the_state) {
+    game_state s;
+    s.mapSize = 33;
+    s.currentRound = 10;
+    s.maxRounds = 400;
+    s.map.resize(33);
+    for (int y = 0; y < 33; y++) {
+        for (int x = 0; x < 33; x++) s.map[y].push_back({ x, y, "AIR" });
+    }
+    s.myPlayer.worms.push_back({ 1, 100, { 0, 0 }, 1, 1, { 2, 4 } });
+    s.opponents.push_back({ 2, 0, { { 1, 100, { 32, 32 }, 1, 1 } } });
+
+    auto candidates = [](auto b) {
+        return (int)b.move_candidates(b.my_worms[0], b.my_worms) |
+            (int)b.move_candidates(b.opponent_worms[0], b.opponent_worms) << 8;
+    };
+    ASSERT_EQ(with_board(s, candidates), (E | SE | S) | (W | NW | N) << 8);
+    ASSERT_EQ(with_board(s, [](auto b) { return (int)b.rounds_left; }), 391);
+
+    s.mapSize = 49;
+    ASSERT_THROW(with_board(s, candidates), runtime_error);
+}
+
 TEST(board, when_all_surrounding_squares_are_deep_space_no_directions_are_move_candidates) {
     uint64_t air_rows[9] = {0, 0, 4, 0, 0, 0, 0, 0, 0};
     uint64_t dirt_rows[9] = {0};
@@ -405,7 +574,107 @@ TEST(board, should_not_be_able_to_shoot_when_obstructed) {
     b.opponent_worms[0] = game_worm(3, 1, 5);
 
     ASSERT_EQ((int)b.shoot_candidates(b.my_worms[0], b.my_worms, b.opponent_worms), NONE);
-    
+
+}
+
+TEST(shot_table, agrees_with_euclidean_range) {
+    for (uint8_t range = 0; range <= MAX_SHOT_RANGE; range++) {
+        for (int8_t dy = -STENCIL_REACH; dy <= STENCIL_REACH; dy++) {
+            for (int8_t dx = -STENCIL_REACH; dx <= STENCIL_REACH; dx++) {
+                bool in_range = sqrt(dx * dx + dy * dy) <= range + sqrt(2);
+                bool north = in_range && abs(dx) <= 1 && dy <= 0;
+                ASSERT_EQ(north, (bool)(SHOT_TABLE.at(range, dx, dy).directions & N));
+            }
+        }
+    }
+    const shot_stencil& north = SHOT_TABLE.at(4, 1, -5);
+    ASSERT_EQ((int)north.directions, N);
+    ASSERT_EQ((int)north.steps[0], 4);
+    const shot_stencil& diagonal = SHOT_TABLE.at(4, 3, 3);
+    ASSERT_EQ((int)diagonal.directions, SE);
+    ASSERT_EQ((int)diagonal.steps[3], 2);
+}
+
+TEST(rotated_layer, matches_the_rows_after_digging) {
+
+    mt19937 mt(17);
+    uint64_t air_rows[9], dirt_rows[9], deep_space_rows[9] = {0};
+    for (int y = 0; y < 9; y++) {
+        air_rows[y] = mt() & 511;
+        dirt_rows[y] = ~air_rows[y] & 511;
+    }
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    board<9> b(dirt, air, deep_space, 4, 3, 1);
+    for (int i = 0; i < 20; i++) b.dig_cell(position(mt() % 9, mt() % 9));
+
+    for (int8_t y = 0; y < 9; y++) {
+        for (int8_t x = 0; x < 9; x++) {
+            position p(x, y);
+            bool expected = b.dirt.contains(p);
+            for (uint8_t o = VERTICAL; o <= ANTI_DIAGONAL; o++) {
+                line_orientation orientation = (line_orientation)o;
+                uint64_t line = b.rotated_obstructions.line(
+                    orientation, rotated_layer<9>::line_of(p, orientation));
+                ASSERT_EQ(expected, (bool)(line >> rotated_layer<9>::index_of(p, orientation) & 1));
+                position back = rotated_layer<9>::cell_at(
+                    orientation, rotated_layer<9>::line_of(p, orientation),
+                    rotated_layer<9>::index_of(p, orientation));
+                ASSERT_TRUE(back == p);
+            }
+        }
+    }
+}
+
+TEST(board, shoot_candidates_match_a_cell_by_cell_check) {
+
+    mt19937 mt(23);
+    for (int trial = 0; trial < 500; trial++) {
+        uint64_t air_rows[9], dirt_rows[9], deep_space_rows[9];
+        for (int y = 0; y < 9; y++) {
+            air_rows[y] = mt() & mt() & 511;
+            deep_space_rows[y] = ~air_rows[y] & mt() & mt() & 511;
+            dirt_rows[y] = ~air_rows[y] & ~deep_space_rows[y] & 511;
+        }
+
+        layer<9> air(air_rows);
+        layer<9> dirt(dirt_rows);
+        layer<9> deep_space(deep_space_rows);
+
+        board<9> b(dirt, air, deep_space, 4, 1 + mt() % 5, 1);
+        for (int i = 0; i < 3; i++) {
+            b.my_worms[i] = game_worm(mt() % 9, mt() % 9, mt() % 3);
+            b.opponent_worms[i] = game_worm(mt() % 9, mt() % 9, mt() % 3);
+        }
+        b.refresh();
+        b.set_action(&b.my_worms[1], action_from_index(mt() % ACTIONS_PER_WORM));
+        b.set_action(&b.my_worms[2], action_from_index(mt() % ACTIONS_PER_WORM));
+
+        game_worm w = b.my_worms[0];
+        uint8_t expected = 0;
+        for (game_worm* e = b.opponent_worms; e != b.opponent_worms + 3; e++) {
+            int8_t dx = e->p.x - w.p.x, dy = e->p.y - w.p.y;
+            if (!e->is_alive()) continue;
+            const shot_stencil& s = SHOT_TABLE.at(b.range, dx, dy);
+            for (uint8_t d = 0; d < 8; d++) {
+                if (!(s.directions >> d & 1)) continue;
+                bool clear = true;
+                for (uint8_t i = 1; i <= s.steps[d]; i++) {
+                    position p(w.p.x + DIRECTION_DX[d] * i, w.p.y + DIRECTION_DY[d] * i);
+                    if (b.obstructed(p) && !b.might_get_dug_out(p, *e, b.my_worms,
+                                                                b.opponent_worms)) {
+                        clear = false;
+                    }
+                    if (b.friendly_worm_will_be_at_position(p, b.my_worms)) clear = false;
+                }
+                if (clear) expected |= 1 << d;
+            }
+        }
+        ASSERT_EQ((int)b.shoot_candidates(w, b.my_worms, b.opponent_worms), (int)expected);
+    }
 }
 
 TEST(board, should_not_be_able_to_shoot_when_a_worm_cant_move_into_firing_line) {
@@ -458,6 +727,927 @@ TEST(board, should_be_able_to_shoot_if_dirt_might_get_dug_out_by_enemy) {
 
 }
 
+TEST(bot_allocator, provides_aligned_bytes_until_exhausted) {
+
+    bot_allocator a(64);
+
+    uint32_t* first = reinterpret_cast<uint32_t*>(a.provide_bytes(12));
+    uint32_t* second = reinterpret_cast<uint32_t*>(a.provide_bytes(20));
+
+    ASSERT_NE(first, nullptr);
+    ASSERT_NE(second, nullptr);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(first) % bot_allocator::ALIGNMENT, 0ULL);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(second) % bot_allocator::ALIGNMENT, 0ULL);
+    ASSERT_EQ(a.bytes_used(), 48ULL);
+
+    ASSERT_EQ(a.provide_bytes(32), nullptr);
+    ASSERT_NE(a.provide_bytes(16), nullptr);
+    ASSERT_EQ(a.bytes_used(), 64ULL);
+}
+
+TEST(bot_allocator, reset_releases_everything_but_keeps_high_water_mark) {
+
+    bot_allocator a(1024);
+
+    a.provide_bytes(100);
+    a.provide_bytes(200);
+    a.free_bytes(200);
+
+    ASSERT_EQ(a.bytes_used(), 112ULL);
+    ASSERT_EQ(a.high_water_mark(), 320ULL);
+
+    a.reset();
+
+    ASSERT_EQ(a.bytes_used(), 0ULL);
+    ASSERT_EQ(a.high_water_mark(), 320ULL);
+    ASSERT_EQ(a.provide_bytes(8), a.base);
+}
+
+TEST(fenwick, finds_the_index_holding_a_cumulative_target) {
+
+    bot_allocator a(1024);
+    fenwick f(6, a);
+
+    f.update(0, 2);
+    f.update(2, 3);
+    f.update(5, 1);
+
+    ASSERT_EQ(f.total, 6U);
+    ASSERT_EQ(f.cumulative_frequency(1), 2);
+    ASSERT_EQ(f.cumulative_frequency(4), 5);
+    ASSERT_EQ(f.find_index(0), 0);
+    ASSERT_EQ(f.find_index(1), 0);
+    ASSERT_EQ(f.find_index(2), 2);
+    ASSERT_EQ(f.find_index(4), 2);
+    ASSERT_EQ(f.find_index(5), 5);
+}
+
+TEST(fenwick, sampling_agrees_with_a_linear_scan) {
+
+    const uint16_t size = 390;
+    bot_allocator a(1 << 16);
+    fenwick f(size, a);
+    uint32_t weights[size];
+    mt19937 mt(7);
+
+    for (uint16_t i = 0; i < size; i++) {
+        weights[i] = mt() % 4 == 0 ? 0 : mt() % 50;
+        f.update(i, weights[i]);
+    }
+
+    for (uint32_t target = 0; target < f.total; target += 7) {
+        uint32_t cumulative = 0;
+        uint16_t expected = 0;
+        while (cumulative + weights[expected] <= target) cumulative += weights[expected++];
+        ASSERT_EQ(f.find_index(target), expected);
+    }
+}
+
+template <typename RNG>
+void check_bounded_draws_are_uniform() {
+    random_buffer<RNG> rng(3);
+    const uint32_t n = 7, draws = 70000;
+    uint32_t counts[n] = {};
+    for (uint32_t i = 0; i < draws; i++) {
+        uint32_t value = rng.below(n);
+        ASSERT_LT(value, n);
+        counts[value]++;
+    }
+    for (uint32_t count : counts) {
+        ASSERT_GT(count, draws / n * 95 / 100);
+        ASSERT_LT(count, draws / n * 105 / 100);
+    }
+}
+
+TEST(random, bounded_draws_are_uniform) {
+    check_bounded_draws_are_uniform<xoshiro256>();
+    check_bounded_draws_are_uniform<pcg32>();
+}
+
+TEST(random, streams_are_reproducible_and_distinct) {
+    xoshiro256 first(11, 2), again(11, 2), other(11, 3);
+    pcg32 second(11, 2), second_again(11, 2), second_other(11, 3);
+    bool xoshiro_differs = false, pcg_differs = false;
+    for (int i = 0; i < 16; i++) {
+        uint32_t value = first.next32();
+        ASSERT_EQ(value, again.next32());
+        xoshiro_differs |= value != other.next32();
+        uint32_t pcg_value = second.next32();
+        ASSERT_EQ(pcg_value, second_again.next32());
+        pcg_differs |= pcg_value != second_other.next32();
+    }
+    ASSERT_TRUE(xoshiro_differs);
+    ASSERT_TRUE(pcg_differs);
+}
+
+TEST(board, hash_is_kept_up_to_date_by_the_simulation) {
+
+    uint64_t air_rows[9] = {0, 0, 511, 511, 511, 511, 511, 0, 0};
+    uint64_t dirt_rows[9] = {511, 511, 0, 0, 0, 0, 0, 511, 511};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 3, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(2, 5, 20);
+    b.my_worms[1] = game_worm(6, 5, 20);
+    b.opponent_worms[0] = game_worm(2, 3, 20);
+    b.opponent_worms[1] = game_worm(6, 3, 20);
+    b.refresh();
+
+    simulation<9> sim(b);
+    for (int i = 0; i < 30 && !sim.game_has_finished(); i++) {
+        sim.step();
+        ASSERT_EQ(sim.b.hash, sim.b.compute_hash());
+    }
+}
+
+TEST(board, transposed_positions_have_the_same_hash) {
+
+    uint64_t air_rows[9] = {0, 0, 511, 511, 511, 511, 511, 0, 0};
+    uint64_t dirt_rows[9] = {511, 511, 0, 0, 0, 0, 0, 511, 511};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 3, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(2, 5, 20);
+    b.opponent_worms[0] = game_worm(6, 2, 20);
+    b.refresh();
+
+    simulation<9> first(b);
+    first.b.my_worms[0].action = first.select_action(E, MOVE);
+    first.apply_actions();
+    first.b.opponent_worms[0].action = first.select_action(N, DIG);
+    first.apply_actions();
+
+    simulation<9> second(b);
+    second.b.opponent_worms[0].action = second.select_action(N, DIG);
+    second.apply_actions();
+    second.b.my_worms[0].action = second.select_action(E, MOVE);
+    second.apply_actions();
+
+    ASSERT_NE(first.b.hash, b.hash);
+    ASSERT_EQ(first.b.hash, second.b.hash);
+
+    second.b.my_worms[0].action = second.select_action(W, MOVE);
+    second.apply_actions();
+
+    ASSERT_NE(first.b.hash, second.b.hash);
+}
+
+TEST(simulation, worms_moving_into_the_same_cell_collide) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    board<9> b(dirt, air, deep_space, 4, 3, 1);
+
+    b.my_worms[0] = game_worm(2, 4, 50);
+    b.opponent_worms[0] = game_worm(4, 4, 50);
+    b.opponent_worms[1] = game_worm(3, 5, 20);
+
+    // Colliding worms swap places or stay put with equal probability.
+    bool stayed = false, swapped = false;
+    for (uint64_t seed = 0; seed < 32; seed++) {
+        simulation<9> sim(b);
+        sim.rng.seed(seed);
+        sim.b.set_action(&sim.b.my_worms[0], sim.select_action(E, MOVE));
+        sim.b.set_action(&sim.b.opponent_worms[0], sim.select_action(W, MOVE));
+        ASSERT_TRUE(sim.b.move_targets[0].contains(position(3, 4)));
+        sim.apply_actions();
+
+        position mine = sim.b.my_worms[0].p, yours = sim.b.opponent_worms[0].p;
+        if (mine == position(2, 4)) {
+            ASSERT_TRUE(yours == position(4, 4));
+            stayed = true;
+        } else {
+            ASSERT_TRUE(mine == position(4, 4));
+            ASSERT_TRUE(yours == position(2, 4));
+            swapped = true;
+        }
+        ASSERT_EQ(sim.b.my_worms[0].health, 50 - COLLISION_DAMAGE);
+        ASSERT_EQ(sim.b.opponent_worms[0].health, 50 - COLLISION_DAMAGE);
+        ASSERT_FALSE(sim.b.move_targets[0].contains(position(3, 4)));
+        ASSERT_FALSE(sim.b.occupied[1].contains(position(3, 4)));
+        ASSERT_TRUE(sim.b.occupied[0].contains(mine));
+        ASSERT_TRUE(sim.b.occupied[1].contains(yours));
+        ASSERT_EQ(sim.b.hash, sim.b.compute_hash());
+
+        ASSERT_TRUE(sim.b.enemy_between(position(3, 3), position(3, 7), sim.b.opponent_worms));
+        ASSERT_EQ(sim.b.enemy_between(position(2, 3), position(2, 7), sim.b.opponent_worms),
+                  yours == position(2, 4));
+    }
+    ASSERT_TRUE(stayed);
+    ASSERT_TRUE(swapped);
+}
+
+TEST(simulation, worms_on_one_side_never_share_a_cell) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    board<9> b(dirt, air, deep_space, 4, 3, 1);
+
+    b.my_worms[0] = game_worm(2, 2, 20);
+    b.my_worms[1] = game_worm(4, 2, 20);
+    b.opponent_worms[0] = game_worm(7, 7, 20);
+    b.refresh();
+
+    // Both of my worms move into (3, 2), the second one stays put.
+    simulation<9> sim(b);
+    uint32_t key = (uint32_t)action_index(sim.select_action(E, MOVE)) |
+        (uint32_t)action_index(sim.select_action(W, MOVE)) << ACTION_BITS;
+    sim.apply_joint_action(key);
+
+    ASSERT_TRUE(sim.b.my_worms[0].p == position(3, 2));
+    ASSERT_TRUE(sim.b.my_worms[1].p == position(4, 2));
+    ASSERT_EQ(sim.b.my_worms[0].health, 20);
+    ASSERT_EQ(sim.b.my_worms[1].health, 20);
+    ASSERT_TRUE(sim.b.occupied[0].contains(position(3, 2)));
+    ASSERT_TRUE(sim.b.occupied[0].contains(position(4, 2)));
+    ASSERT_TRUE(sim.b.move_targets[0].empty());
+    ASSERT_EQ(sim.b.hash, sim.b.compute_hash());
+
+    // Moving the first worm away leaves the second where it was.
+    sim.apply_joint_action(action_index(sim.select_action(W, MOVE)));
+    ASSERT_TRUE(sim.b.my_worms[0].p == position(2, 2));
+    ASSERT_FALSE(sim.b.occupied[0].contains(position(3, 2)));
+    ASSERT_TRUE(sim.b.occupied[0].contains(position(4, 2)));
+}
+
+TEST(simulation, nth_set_bit_matches_a_bit_by_bit_search) {
+    for (uint16_t mask = 1; mask < 256; mask++) {
+        uint8_t remaining = mask;
+        for (uint8_t n = 0; n < __builtin_popcount(mask); n++) {
+            ASSERT_EQ(nth_set_bit(mask, n), remaining & -remaining);
+            ASSERT_EQ(1 << SET_BIT_TABLE.positions[mask][n], remaining & -remaining);
+            remaining &= remaining - 1;
+        }
+    }
+}
+
+TEST(simulation, action_indices_round_trip) {
+    for (uint8_t i = 0; i < ACTIONS_PER_WORM; i++) {
+        ASSERT_EQ(action_index(action_from_index(i)), i);
+    }
+}
+
+TEST(simulation, shooting_damages_the_first_worm_in_the_line_of_fire) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 3, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(2, 4, 5);
+    b.opponent_worms[0] = game_worm(2, 2, 5);
+    b.opponent_worms[1] = game_worm(2, 1, 5);
+
+    simulation<9> sim(b);
+
+    sim.b.my_worms[0].action = sim.select_action(N, SHOOT);
+    sim.apply_actions();
+
+    ASSERT_EQ(sim.b.opponent_worms[0].health, 1);
+    ASSERT_EQ(sim.b.opponent_worms[1].health, 5);
+}
+
+TEST(simulation, digging_turns_dirt_into_air) {
+
+    uint64_t air_rows[9] = {0, 0, 4, 0, 0, 0, 0, 0, 0};
+    uint64_t dirt_rows[9] = { 511, 511, 507, 511, 511, 511, 511, 511, 511 };
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 6, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(2, 2, 5);
+
+    simulation<9> sim(b);
+
+    sim.b.my_worms[0].action = sim.select_action(E, DIG);
+    sim.apply_actions();
+
+    ASSERT_EQ(sim.b.dirt.rows()[2], 499ULL);
+    ASSERT_EQ(sim.b.air_row(2), 12ULL);
+}
+
+TEST(simulation, rollout_always_terminates_with_a_score) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 3, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(1, 1, 20);
+    b.opponent_worms[0] = game_worm(7, 7, 20);
+
+    simulation<9> sim(b);
+    sim.rollout();
+
+    result_score score = sim.determine_score();
+    ASSERT_TRUE(score == I_WIN || score == DRAW || score == YOU_WIN);
+}
+
+TEST(simulation, rollouts_stop_at_the_cutoff_or_when_the_rounds_run_out) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 1, range = 1, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(1, 1, 1000);
+    b.opponent_worms[0] = game_worm(7, 7, 1000);
+    b.rounds_left = 20;
+
+    simulation<9> sim(b);
+    ASSERT_EQ(sim.rollout(3), 3);
+    ASSERT_EQ(sim.b.rounds_left, 17);
+    ASSERT_FALSE(sim.game_has_finished());
+
+    ASSERT_EQ(sim.rollout(), 17);
+    ASSERT_EQ(sim.b.rounds_left, 0);
+    ASSERT_TRUE(sim.game_has_finished());
+}
+
+TEST(tree, every_playout_is_backed_up_to_the_root) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 3, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(2, 4, 12);
+    b.my_worms[1] = game_worm(6, 4, 12);
+    b.opponent_worms[0] = game_worm(2, 1, 12);
+    b.opponent_worms[1] = game_worm(6, 1, 12);
+
+    bot_allocator a(1 << 24);
+    tree<9> t(&a, b);
+    t.reset_root();
+
+    for (int i = 0; i < 500; i++) t.simulate_round();
+
+    ASSERT_EQ(t.root->total_visits, 500U);
+    ASSERT_NE(t.root->first_edge, nullptr);
+    ASSERT_EQ(t.stats.playouts, 500ULL);
+
+    moves best = t.best_moves();
+    ASSERT_NE(best.actions[0].a, NOTHING);
+    ASSERT_NE(best.actions[1].a, NOTHING);
+    ASSERT_EQ(best.actions[2].a, NOTHING);
+}
+
+TEST(tree, a_transposition_back_onto_the_path_is_backed_up_once) {
+
+    // Each worm can only step between two cells, so every second round
+    // returns to the root position.
+    uint64_t air_rows[9] = {0, 6, 0, 0, 0, 0, 0, 6, 0};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {511, 505, 511, 511, 511, 511, 511, 505, 511};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 3, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(1, 7, 12);
+    b.opponent_worms[0] = game_worm(1, 1, 12);
+
+    bot_allocator a(1 << 24);
+    tree<9> t(&a, b);
+    t.reset_root();
+
+    for (int i = 0; i < 100; i++) t.simulate_round();
+
+    ASSERT_EQ(t.root->total_visits, 100U);
+}
+
+TEST(tree, search_runs_until_the_time_budget_is_spent) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 3, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(2, 4, 12);
+    b.opponent_worms[0] = game_worm(2, 1, 12);
+
+    bot_allocator a(1 << 24);
+    tree<9> t(&a, b);
+    t.search(chrono::milliseconds(50));
+
+    ASSERT_GE(t.stats.seconds, 0.05);
+    ASSERT_GT(t.stats.playouts, 0ULL);
+    ASSERT_GT(t.stats.playouts_per_second(), 0);
+}
+
+TEST(searcher, root_parallel_search_merges_every_tree) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 3, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(2, 4, 12);
+    b.opponent_worms[0] = game_worm(2, 1, 12);
+
+    search_config config;
+    config.mode = ROOT_PARALLEL;
+    config.threads = 3;
+    config.arena_bytes = 1 << 24;
+    config.budget = chrono::milliseconds(30);
+
+    searcher<9> s(config);
+    moves best = s.search(b);
+
+    ASSERT_EQ(s.trees.size(), 3ULL);
+    uint64_t playouts = 0;
+    for (auto& t : s.trees) {
+        ASSERT_GT(t->stats.playouts, 0ULL);
+        playouts += t->stats.playouts;
+    }
+    ASSERT_EQ(s.stats.playouts, playouts);
+    ASSERT_NE(best.actions[0].a, NOTHING);
+}
+
+TEST(searcher, tree_parallel_search_shares_one_tree) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 3, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(2, 4, 12);
+    b.opponent_worms[0] = game_worm(2, 1, 12);
+
+    search_config config;
+    config.mode = TREE_PARALLEL;
+    config.threads = 3;
+    config.arena_bytes = 1 << 24;
+    config.budget = chrono::milliseconds(30);
+
+    searcher<9> s(config);
+    moves best = s.search(b);
+
+    ASSERT_EQ(s.trees.size(), 1ULL);
+    ASSERT_GT(s.stats.playouts, 0ULL);
+    ASSERT_EQ(s.trees[0]->root->total_visits, s.stats.playouts);
+    ASSERT_NE(best.actions[0].a, NOTHING);
+}
+
+TEST(node, virtual_loss_is_given_back_on_update) {
+
+    bot_allocator a(1 << 16);
+    uint32_t candidates[WORMS] = { 6, 1, 1, 1, 1, 1 };
+    node n(candidates, 0, a);
+
+    uint32_t joint_action = 1;
+    ASSERT_EQ(n.apply_virtual_loss(joint_action), 0b111111);
+    ASSERT_EQ(n.weights[1], INITIAL_WEIGHT - VIRTUAL_LOSS);
+    ASSERT_EQ(n.f.total, WORMS * (INITIAL_WEIGHT - VIRTUAL_LOSS) + INITIAL_WEIGHT);
+
+    n.update(joint_action, DRAW, 0b111111);
+
+    ASSERT_EQ(n.weights[1], INITIAL_WEIGHT + DRAW);
+    ASSERT_EQ(n.visits[1], 1U);
+    ASSERT_EQ(n.f.total, WORMS * (INITIAL_WEIGHT + DRAW) + INITIAL_WEIGHT);
+}
+
+TEST(transposition_table, replaces_the_least_visited_entry_of_a_full_bucket) {
+
+    bot_allocator a(1 << 20);
+    transposition_table table(4, a);
+    uint32_t candidates[WORMS] = { 1, 1, 1, 1, 1, 1 };
+
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(table.buckets) % CACHE_LINE, 0ULL);
+
+    node* nodes[5];
+    for (uint8_t i = 0; i < 5; i++) {
+        nodes[i] = new (a.provide_bytes(sizeof(node))) node(candidates, i * 4, a);
+        nodes[i]->total_visits = i == 2 ? 1 : 10;
+    }
+    for (uint8_t i = 0; i < 4; i++) table.store(nodes[i]->hash, nodes[i]);
+
+    ASSERT_EQ(table.find(8), nodes[2]);
+    ASSERT_EQ(table.find(1), nullptr);
+
+    table.store(nodes[4]->hash, nodes[4]);
+
+    ASSERT_EQ(table.find(16), nodes[4]);
+    ASSERT_EQ(table.find(8), nullptr);
+    ASSERT_EQ(table.find(0), nodes[0]);
+}
+
+// Edges leading to a node that another edge has already reached.
+uint32_t shared_children(node* root) {
+    uint32_t shared = 0;
+    vector<node*> pending = { root };
+    set<node*> seen = { root };
+    while (!pending.empty()) {
+        node* n = pending.back();
+        pending.pop_back();
+        for (edge* e = n->first_edge; e; e = e->next) {
+            if (!seen.insert(e->child).second) shared++;
+            else pending.push_back(e->child);
+        }
+    }
+    return shared;
+}
+
+TEST(tree, transposed_positions_share_a_node) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 1, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(1, 4, 12);
+    b.opponent_worms[0] = game_worm(7, 4, 12);
+
+    bot_allocator a(1 << 26);
+    tree<9> t(&a, b);
+    t.reset_root();
+    for (int i = 0; i < 3000; i++) t.simulate_round();
+
+    ASSERT_NE(t.root->first_edge, nullptr);
+    ASSERT_GT(shared_children(t.root), 0U);
+
+    // Close to the end of the game the rounds left matter, and they aren't
+    // part of the hash.
+    b.rounds_left = t.rollout_depth;
+    tree<9> near_the_end(&a, b);
+    near_the_end.reset_root();
+    for (int i = 0; i < 3000; i++) near_the_end.simulate_round();
+
+    ASSERT_NE(near_the_end.root->first_edge, nullptr);
+    ASSERT_EQ(shared_children(near_the_end.root), 0U);
+}
+
+TEST(tree, advancing_the_root_keeps_the_matching_subtree) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 1, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(1, 4, 12);
+    b.opponent_worms[0] = game_worm(7, 4, 12);
+
+    bot_allocator a(1 << 26);
+    tree<9> t(&a, b);
+    t.use_transpositions = false;
+    t.reset_root();
+    for (int i = 0; i < 2000; i++) t.simulate_round();
+
+    edge* taken = t.root->first_edge;
+    for (edge* e = t.root->first_edge; e; e = e->next) {
+        if (e->child->total_visits > taken->child->total_visits) taken = e;
+    }
+    node* old_child = taken->child;
+    uint32_t child_visits = old_child->total_visits;
+    uint64_t used = a.bytes_used();
+
+    simulation<9> sim(t.current_state);
+    sim.apply_joint_action(taken->key);
+    moves played;
+    for (uint8_t i = 0; i < 3; i++) {
+        played.actions[i] = action_from_index(joint_action_part(taken->key, i));
+    }
+
+    ASSERT_TRUE(t.advance_root(sim.b, played));
+    ASSERT_EQ(t.root->hash, sim.b.hash);
+    ASSERT_EQ(t.root->total_visits, child_visits);
+    ASSERT_EQ(reinterpret_cast<uint8_t*>(t.root), a.base);
+    ASSERT_LT(a.bytes_used(), used);
+
+    for (int i = 0; i < 500; i++) t.simulate_round();
+    ASSERT_EQ(t.root->total_visits, child_visits + 500);
+
+    sim.apply_joint_action(0);
+    ASSERT_FALSE(t.advance_root(sim.b, played));
+    ASSERT_EQ(t.root, nullptr);
+}
+
+TEST(tree, advancing_the_root_rebuilds_the_transposition_table) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    uint8_t damage = 4, range = 1, digging_range = 1;
+
+    board<9> b(dirt, air, deep_space, damage, range, digging_range);
+
+    b.my_worms[0] = game_worm(1, 4, 12);
+    b.opponent_worms[0] = game_worm(7, 4, 12);
+
+    bot_allocator a(1 << 26);
+    tree<9> t(&a, b);
+    t.reset_root();
+    for (int i = 0; i < 2000; i++) t.simulate_round();
+
+    edge* taken = t.root->first_edge;
+    simulation<9> sim(t.current_state);
+    sim.apply_joint_action(taken->key);
+    moves played;
+    for (uint8_t i = 0; i < 3; i++) {
+        played.actions[i] = action_from_index(joint_action_part(taken->key, i));
+    }
+
+    ASSERT_TRUE(t.advance_root(sim.b, played));
+    ASSERT_EQ(t.table->find(t.root->hash), t.root);
+
+    for (int i = 0; i < 500; i++) t.simulate_round();
+    ASSERT_EQ(t.table->find(t.root->hash), t.root);
+}
+
+board<9> random_board(mt19937& mt) {
+    uint64_t air_rows[9], dirt_rows[9], deep_space_rows[9];
+    for (int y = 0; y < 9; y++) {
+        air_rows[y] = (mt() | mt()) & 511;
+        deep_space_rows[y] = ~air_rows[y] & mt() & mt() & 511;
+        dirt_rows[y] = ~air_rows[y] & ~deep_space_rows[y] & 511;
+    }
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+    board<9> b(dirt, air, deep_space, 4, 1 + mt() % 4, 1);
+    for (int i = 0; i < 3; i++) {
+        b.my_worms[i] = game_worm(mt() % 9, mt() % 9, mt() % 10);
+        b.opponent_worms[i] = game_worm(mt() % 9, mt() % 9, mt() % 10);
+    }
+    b.refresh();
+    return b;
+}
+
+TEST(evaluation, mirrored_positions_score_zero_and_health_counts) {
+
+    uint64_t air_rows[9], dirt_rows[9] = { 0, 16, 0, 0, 68, 0, 0, 16, 0 };
+    uint64_t deep_space_rows[9] = {0};
+    for (int y = 0; y < 9; y++) air_rows[y] = ~dirt_rows[y] & 511;
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    board<9> b(dirt, air, deep_space, 4, 3, 1);
+    b.my_worms[0] = game_worm(2, 6, 20);
+    b.my_worms[1] = game_worm(6, 6, 20);
+    b.opponent_worms[0] = game_worm(2, 2, 20);
+    b.opponent_worms[1] = game_worm(6, 2, 20);
+    b.refresh();
+
+    distance_map<9> map;
+    ASSERT_EQ(evaluate_board(b, map), 0);
+
+    b.damage_worm(&b.opponent_worms[0], 4);
+    ASSERT_EQ(evaluate_board(b, map), 4);
+}
+
+TEST(evaluation, shooters_need_range_and_a_clear_line) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    board<9> b(dirt, air, deep_space, 4, 3, 1);
+    b.my_worms[0] = game_worm(1, 4, 20);
+    b.opponent_worms[0] = game_worm(4, 4, 20);
+    b.refresh();
+    ASSERT_EQ(shooters(b, b.my_worms, b.opponent_worms), 1);
+
+    b.dirt.set(position(2, 4));
+    b.refresh();
+    ASSERT_EQ(shooters(b, b.my_worms, b.opponent_worms), 0);
+
+    b.opponent_worms[0] = game_worm(3, 2, 20);
+    b.refresh();
+    ASSERT_EQ(shooters(b, b.my_worms, b.opponent_worms), 1);
+
+    b.opponent_worms[0] = game_worm(5, 0, 20);
+    b.refresh();
+    ASSERT_EQ(shooters(b, b.my_worms, b.opponent_worms), 0);
+}
+
+TEST(evaluation, reachable_area_matches_a_cell_by_cell_search) {
+
+    mt19937 mt(41);
+    for (int trial = 0; trial < 50; trial++) {
+        board<9> b = random_board(mt);
+        uint8_t steps = mt() % 5;
+        layer<9> open = b.air();
+        // Worms only ever stand in the open.
+        for (game_worm& w : b.my_worms) {
+            if (!open.contains(w.p)) w.health = 0;
+        }
+        b.refresh();
+        set<pair<int, int>> reached;
+        for (game_worm& w : b.my_worms) {
+            if (w.is_alive()) reached.insert({ w.p.x, w.p.y });
+        }
+        for (uint8_t i = 0; i < steps; i++) {
+            set<pair<int, int>> next;
+            for (auto c : reached) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        position p(c.first + dx, c.second + dy);
+                        if (b.on_board(p) && open.contains(p)) next.insert({ p.x, p.y });
+                    }
+                }
+            }
+            reached = next;
+        }
+        distance_map<9> map;
+        ASSERT_EQ(reachable_area(b, b.my_worms, steps, map), reached.size());
+    }
+}
+
+TEST(distance_map, matches_a_cell_by_cell_search) {
+
+    mt19937 mt(43);
+    for (int trial = 0; trial < 50; trial++) {
+        board<9> b = random_board(mt);
+        position source(mt() % 9, mt() % 9);
+        bool through_dirt = trial & 1;
+        distance_map<9> map;
+        map.compute(b, source, through_dirt);
+
+        int expected[9][9];
+        for (auto& row : expected) fill(row, row + 9, (int)UNREACHABLE);
+        expected[source.y][source.x] = 0;
+        set<pair<int, pair<int, int>>> queue = { { 0, { source.x, source.y } } };
+        while (!queue.empty()) {
+            auto current = *queue.begin();
+            queue.erase(queue.begin());
+            for (uint8_t d = 1; d; d <<= 1) {
+                position p = position(current.second.first, current.second.second) +
+                    board<9>::direction_offset(d);
+                if (!b.on_board(p) || b.deep_space.contains(p)) continue;
+                if (b.dirt.contains(p) && !through_dirt) continue;
+                int distance = current.first + (b.dirt.contains(p) ? DIG_AND_MOVE : 1);
+                if (distance >= expected[p.y][p.x]) continue;
+                expected[p.y][p.x] = distance;
+                queue.insert({ distance, { p.x, p.y } });
+            }
+        }
+        for (int8_t y = 0; y < 9; y++) {
+            for (int8_t x = 0; x < 9; x++) {
+                ASSERT_EQ(map.distance(position(x, y)), expected[y][x]);
+                ASSERT_EQ(map.within(3).contains(position(x, y)), expected[y][x] <= 3);
+            }
+        }
+    }
+}
+
+TEST(policy, heavy_policy_only_picks_available_actions) {
+
+    mt19937 mt(53);
+    for (int trial = 0; trial < 200; trial++) {
+        simulation<9, xoshiro256, heavy_policy> sim(random_board(mt));
+        sim.rng.seed(trial);
+        board<9>& b = sim.b;
+        for (game_worm& w : b.my_worms) {
+            if (!w.is_alive()) continue;
+            uint32_t candidates = sim.action_candidates(w, b.my_worms, b.opponent_worms);
+            selected_action a = sim.select_action(w, b.my_worms, b.opponent_worms);
+            if (candidates == 1) {
+                ASSERT_TRUE(a.a == NOTHING || a.a == SHOOT);
+            } else {
+                ASSERT_TRUE(candidates >> action_index(a) & 1);
+            }
+        }
+    }
+}
+
+TEST(policy, heavy_policy_prefers_shots_that_hit) {
+
+    uint64_t air_rows[9] = {511, 511, 511, 511, 511, 511, 511, 511, 511};
+    uint64_t dirt_rows[9] = {0};
+    uint64_t deep_space_rows[9] = {0};
+
+    layer<9> air(air_rows);
+    layer<9> dirt(dirt_rows);
+    layer<9> deep_space(deep_space_rows);
+
+    board<9> b(dirt, air, deep_space, 4, 3, 1);
+    b.my_worms[0] = game_worm(1, 4, 20);
+    b.opponent_worms[0] = game_worm(4, 4, 20);
+    b.refresh();
+
+    simulation<9> light(b);
+    simulation<9, xoshiro256, heavy_policy> heavy(b);
+    int light_hits = 0, heavy_hits = 0;
+    for (int i = 0; i < 1000; i++) {
+        selected_action l = light.select_action(b.my_worms[0], b.my_worms, b.opponent_worms);
+        selected_action h = heavy.select_action(b.my_worms[0], b.my_worms, b.opponent_worms);
+        light_hits += l.a == SHOOT && l.p == position(1, 0);
+        heavy_hits += h.a == SHOOT && h.p == position(1, 0);
+    }
+    ASSERT_LT(light_hits, 500);
+    ASSERT_GT(heavy_hits, 500);
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -3,37 +3,489 @@
 
 #include "simulation.hpp"
 #include <random>
+#include <chrono>
+#include <new>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
 #include "fenwick.hpp"
 
 using namespace std;
 
+const uint8_t WORMS = 6;
+const uint16_t NODE_ACTIONS = WORMS * ACTIONS_PER_WORM;
+const uint32_t INITIAL_WEIGHT = 2;
+const uint32_t VIRTUAL_LOSS = 1;
+
+// Each worm chooses its own action at every node (decoupled selection for
+// simultaneous moves). Actions are sampled in proportion to the reward
+// they have collected, the weights of all six worms live in one fenwick
+// tree with a segment of ACTIONS_PER_WORM entries per worm. Edges to the
+// children are keyed by the joint action of all six worms, several edges
+// can lead to the same node when positions transpose.
+//
+// Statistics are updated with atomic adds and children are linked in with
+// a compare and swap so that several threads can share one tree. While a
+// thread is descending through an action it takes VIRTUAL_LOSS off the
+// action's weight, which steers other threads to different branches.
+struct node;
+
+struct edge {
+    uint32_t key;
+    node* child;
+    edge* next;
+};
+
 struct node {
 
-    node(int16_t size, bot_allocator& a) 
-        : f(size, a), children(reinterpret_cast<uint32_t*>(a.provide_bytes(size * 4))) { }
+    node(const uint32_t* worm_candidates, uint64_t hash, bot_allocator& a)
+        : hash(hash), f(NODE_ACTIONS, a),
+          visits(reinterpret_cast<uint32_t*>(a.provide_bytes(NODE_ACTIONS * 4))),
+          weights(reinterpret_cast<uint32_t*>(a.provide_bytes(NODE_ACTIONS * 4))) {
+        if (!is_valid()) return;
+        memset(visits, 0, NODE_ACTIONS * 4);
+        memset(weights, 0, NODE_ACTIONS * 4);
+        for (uint8_t w = 0; w < WORMS; w++) {
+            candidates[w] = worm_candidates[w];
+            for (uint8_t i = 0; i < ACTIONS_PER_WORM; i++) {
+                if (candidates[w] & 1 << i) {
+                    weights[w * ACTIONS_PER_WORM + i] = INITIAL_WEIGHT;
+                    f.update(w * ACTIONS_PER_WORM + i, INITIAL_WEIGHT);
+                }
+            }
+        }
+    }
 
+    uint64_t hash;
     fenwick f;
-    uint32_t* children;
-    
-    uint16_t select_node(uint32_t random_bytes) {
-        uint32_t threshold = random_bytes % f.total;
-        return f.find_index(threshold);
+    uint32_t* visits;
+    uint32_t* weights;
+    uint32_t candidates[WORMS];
+    uint32_t total_visits = 0;
+    edge* first_edge = nullptr;
+
+    bool is_valid() { return f.freq && visits && weights; }
+
+    template <typename R>
+    uint8_t select_node(uint8_t worm, R& rng) {
+        uint16_t start = worm * ACTIONS_PER_WORM;
+        uint32_t before = start ? f.cumulative_frequency(start - 1) : 0;
+        uint32_t segment = f.cumulative_frequency(start + ACTIONS_PER_WORM - 1) - before;
+        uint8_t result = segment ? f.find_index(before + rng.below(segment)) - start : 0;
+        // Racing updates can skew a sample onto an unavailable action.
+        if (result >= ACTIONS_PER_WORM || !(candidates[worm] & 1 << result)) {
+            result = __builtin_ctz(candidates[worm]);
+        }
+        return result;
+    }
+
+    template <typename R>
+    uint32_t select_joint_action(R& rng) {
+        uint32_t result = 0;
+        for (uint8_t w = 0; w < WORMS; w++) {
+            result |= (uint32_t)select_node(w, rng) << (w * ACTION_BITS);
+        }
+        return result;
+    }
+
+    node* find_child(uint32_t joint_action) {
+        for (edge* it = __atomic_load_n(&first_edge, __ATOMIC_ACQUIRE); it; it = it->next) {
+            if (it->key == joint_action) return it->child;
+        }
+        return nullptr;
+    }
+
+    // Returns the child that ends up in the tree, which is an existing one
+    // if another thread added the same joint action first, or nullptr if
+    // the arena is full.
+    node* add_child(uint32_t joint_action, node* child, bot_allocator& a) {
+        edge* e = reinterpret_cast<edge*>(a.provide_bytes(sizeof(edge)));
+        if (!e) return nullptr;
+        e->key = joint_action;
+        e->child = child;
+        edge* head = __atomic_load_n(&first_edge, __ATOMIC_ACQUIRE);
+        do {
+            for (edge* it = head; it; it = it->next) {
+                if (it->key == joint_action) return it->child;
+            }
+            e->next = head;
+        } while (!__atomic_compare_exchange_n(&first_edge, &head, e, true,
+                                              __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+        return child;
+    }
+
+    void add_weight(uint16_t index, uint32_t value) {
+        __atomic_fetch_add(weights + index, value, __ATOMIC_RELAXED);
+        f.update(index, value);
+    }
+
+    // Returns a bit per worm for the actions that took the loss, weights
+    // are never taken below one.
+    uint8_t apply_virtual_loss(uint32_t joint_action) {
+        uint8_t applied = 0;
+        for (uint8_t w = 0; w < WORMS; w++) {
+            uint16_t index = w * ACTIONS_PER_WORM + joint_action_part(joint_action, w);
+            uint32_t current = __atomic_load_n(weights + index, __ATOMIC_RELAXED);
+            bool taken = false;
+            while (current > VIRTUAL_LOSS && !taken) {
+                taken = __atomic_compare_exchange_n(weights + index, &current,
+                                                    current - VIRTUAL_LOSS, true,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            }
+            if (taken) {
+                f.update(index, -VIRTUAL_LOSS);
+                applied |= 1 << w;
+            }
+        }
+        return applied;
+    }
+
+    void update(uint32_t joint_action, result_score score, uint8_t virtual_losses = 0) {
+        __atomic_fetch_add(&total_visits, 1, __ATOMIC_RELAXED);
+        for (uint8_t w = 0; w < WORMS; w++) {
+            uint16_t index = w * ACTIONS_PER_WORM + joint_action_part(joint_action, w);
+            __atomic_fetch_add(visits + index, 1, __ATOMIC_RELAXED);
+            uint32_t reward = w < 3 ? score : I_WIN - score;
+            if (virtual_losses & 1 << w) reward += VIRTUAL_LOSS;
+            if (reward) add_weight(index, reward);
+        }
+    }
+
+    uint8_t most_visited(uint8_t worm) {
+        uint32_t* start = visits + worm * ACTIONS_PER_WORM;
+        return max_element(start, start + ACTIONS_PER_WORM) - start;
     }
 
 };
 
-template <uint8_t WIDTH>
+// Rough arena footprint of a node with one edge leading to it.
+inline uint64_t node_bytes() {
+    return bot_allocator::round_up(sizeof(node)) + bot_allocator::round_up(sizeof(edge)) +
+        3 * bot_allocator::round_up(NODE_ACTIONS * 4 + 4);
+}
+
+struct tt_entry {
+    uint64_t key;
+    node* n;
+};
+
+const uint8_t TT_BUCKET_ENTRIES = 4;
+const uint8_t CACHE_LINE = 64;
+
+struct alignas(CACHE_LINE) tt_bucket {
+    tt_entry entries[TT_BUCKET_ENTRIES];
+};
+
+// Maps position hashes to nodes so transposed positions share statistics.
+// Buckets are a cache line each and the table lives in the arena, sized
+// for about one entry per node the arena can hold. When a bucket is full
+// the least visited entry is replaced, the node it pointed at stays in the
+// tree and only loses the chance to be shared.
+struct transposition_table {
+
+    transposition_table(uint32_t bucket_count, bot_allocator& a) {
+        void* memory = a.provide_bytes(bucket_count * sizeof(tt_bucket) + CACHE_LINE);
+        if (!memory) return;
+        uintptr_t aligned = (reinterpret_cast<uintptr_t>(memory) + CACHE_LINE - 1) &
+            ~(uintptr_t)(CACHE_LINE - 1);
+        buckets = reinterpret_cast<tt_bucket*>(aligned);
+        mask = bucket_count - 1;
+        memset(buckets, 0, bucket_count * sizeof(tt_bucket));
+    }
+
+    static uint32_t buckets_for(uint64_t arena_bytes) {
+        uint64_t entries = arena_bytes / node_bytes();
+        uint64_t count = max<uint64_t>(1, entries / TT_BUCKET_ENTRIES);
+        return 1U << (63 - __builtin_clzll(min<uint64_t>(count, 1U << 31)));
+    }
+
+    tt_bucket* buckets = nullptr;
+    uint32_t mask = 0;
+
+    bool is_valid() { return buckets; }
+
+    node* find(uint64_t key) {
+        tt_bucket& b = buckets[key & mask];
+        for (tt_entry& e : b.entries) {
+            if (e.n && e.key == key) return e.n;
+        }
+        return nullptr;
+    }
+
+    void store(uint64_t key, node* n) {
+        tt_bucket& b = buckets[key & mask];
+        tt_entry* victim = b.entries;
+        for (tt_entry& e : b.entries) {
+            if (!e.n || e.key == key) {
+                victim = &e;
+                break;
+            }
+            if (e.n->total_visits < victim->n->total_visits) victim = &e;
+        }
+        victim->key = key;
+        victim->n = n;
+    }
+
+};
+
+struct search_stats {
+    uint64_t playouts = 0;
+    double seconds = 0;
+
+    double playouts_per_second() const {
+        return seconds > 0 ? playouts / seconds : 0;
+    }
+};
+
+template <uint8_t WIDTH, typename POLICY = light_policy>
 struct tree {
-    
 
+    typedef simulation<WIDTH, xoshiro256, POLICY> simulation_type;
+
+    static const uint8_t MAX_DEPTH = 64;
 
-    explicit tree(bot_allocator* a) : a(a) {}
+    tree(bot_allocator* a, const board<WIDTH>& state, uint64_t seed = DEFAULT_SEED,
+         uint64_t stream = 0)
+        : a(a), current_state(state), sim(state), seed(seed) {
+        sim.rng.seed(seed, stream);
+    }
 
     bot_allocator* a;
     board<WIDTH> current_state;
+    simulation_type sim;
+    uint64_t seed;
+    node* root = nullptr;
+    transposition_table* table = nullptr;
+    // The table isn't safe for threads sharing the tree.
+    bool use_transpositions = true;
+    // Rounds each playout is rolled out for past the tree.
+    uint16_t rollout_depth = MAX_ROLLOUT_STEPS;
+    search_stats stats;
+
+    // Allocates a node for the position currently held by the simulation,
+    // returns nullptr once the arena is full.
+    node* new_node(simulation_type& s) {
+        uint32_t candidates[WORMS];
+        board<WIDTH>& b = s.b;
+        for (uint8_t i = 0; i < 3; i++) {
+            candidates[i] = s.action_candidates(b.my_worms[i], b.my_worms, b.opponent_worms);
+            candidates[i + 3] = s.action_candidates(b.opponent_worms[i], b.opponent_worms,
+                                                    b.my_worms);
+        }
+        void* memory = a->provide_bytes(sizeof(node));
+        if (!memory) return nullptr;
+        node* result = new (memory) node(candidates, b.hash, *a);
+        return result->is_valid() ? result : nullptr;
+    }
+
+    void reset_root() {
+        a->reset();
+        table = nullptr;
+        if (use_transpositions) {
+            void* memory = a->provide_bytes(sizeof(transposition_table));
+            if (memory) {
+                table = new (memory) transposition_table(
+                    transposition_table::buckets_for(a->capacity), *a);
+                if (!table->is_valid()) table = nullptr;
+            }
+        }
+        current_state.refresh();
+        sim.b = current_state;
+        root = new_node(sim);
+        if (root && table) table->store(root->hash, root);
+    }
+
+    // Finds the node reached by a joint action, creating one (or linking in
+    // a transposition) when it isn't there yet. Sets created when the node
+    // is new so the caller can stop descending.
+    node* child_for(node* current, uint32_t joint_action, simulation_type& s,
+                    bool& created) {
+        created = false;
+        node* child = current->find_child(joint_action);
+        if (child) return child;
+        // The hash leaves out the rounds left, so positions are only merged
+        // while the round limit is out of reach of the rollouts.
+        bool merge = table && s.b.rounds_left > rollout_depth;
+        child = merge ? table->find(s.b.hash) : nullptr;
+        if (!child) {
+            child = new_node(s);
+            if (!child) return nullptr;
+            created = true;
+            if (table) table->store(child->hash, child);
+        }
+        node* linked = current->add_child(joint_action, child, *a);
+        created &= linked == child;
+        return linked;
+    }
 
     void simulate_round() {
+        simulate_round(sim, false);
+        stats.playouts++;
+    }
+
+    // One playout: select joint actions down the tree, expand a single new
+    // node, roll out randomly from there and back up the result. Threads
+    // sharing the tree each pass their own simulation.
+    void simulate_round(simulation_type& s, bool shared) {
+        node* path[MAX_DEPTH];
+        uint32_t actions[MAX_DEPTH];
+        uint8_t virtual_losses[MAX_DEPTH];
+        uint8_t depth = 0;
+        s.b = current_state;
+        node* current = root;
+        while (current && depth < MAX_DEPTH) {
+            uint32_t joint_action = current->select_joint_action(s.rng);
+            path[depth] = current;
+            virtual_losses[depth] = shared ? current->apply_virtual_loss(joint_action) : 0;
+            actions[depth++] = joint_action;
+            s.apply_joint_action(joint_action);
+            if (s.game_has_finished()) break;
+            bool created;
+            current = child_for(current, joint_action, s, created);
+            // A transposition back to a node already on the path would back
+            // the playout up through that node twice.
+            if (created || find(path, path + depth, current) != path + depth) break;
+        }
+        s.rollout(rollout_depth);
+        result_score score = s.determine_score();
+        while (depth) {
+            depth--;
+            path[depth]->update(actions[depth], score, virtual_losses[depth]);
+        }
+    }
+
+    // Worker loop for threads sharing this tree, the root must already
+    // exist and the arena must be marked concurrent. Each worker should be
+    // given its own random stream.
+    uint64_t search_shared(chrono::steady_clock::time_point deadline, uint64_t stream) {
+        simulation_type s(current_state);
+        s.rng.seed(seed, stream);
+        uint64_t playouts = 0;
+        while (chrono::steady_clock::now() < deadline) {
+            simulate_round(s, true);
+            playouts++;
+        }
+        return playouts;
+    }
+
+    moves best_moves() {
+        moves result;
+        for (uint8_t i = 0; i < 3; i++) {
+            result.actions[i] = root ? action_from_index(root->most_visited(i)) :
+                selected_action();
+        }
+        return result;
+    }
+
+    // Copies a node and its arrays to the end of the arena with pointers
+    // written as they will be once the copy has been moved down by shift.
+    node* copy_node(node* n, uint64_t shift) {
+        node* copy = reinterpret_cast<node*>(a->provide_bytes(sizeof(node)));
+        uint32_t* freq = reinterpret_cast<uint32_t*>(a->provide_bytes((n->f.size + 1) * 4));
+        uint32_t* visits = reinterpret_cast<uint32_t*>(a->provide_bytes(NODE_ACTIONS * 4));
+        uint32_t* weights = reinterpret_cast<uint32_t*>(a->provide_bytes(NODE_ACTIONS * 4));
+        if (!copy || !freq || !visits || !weights) return nullptr;
+        memcpy(copy, n, sizeof(node));
+        memcpy(freq, n->f.freq, (n->f.size + 1) * 4);
+        memcpy(visits, n->visits, NODE_ACTIONS * 4);
+        memcpy(weights, n->weights, NODE_ACTIONS * 4);
+        copy->f.freq = shifted(freq, shift);
+        copy->visits = shifted(visits, shift);
+        copy->weights = shifted(weights, shift);
+        copy->first_edge = nullptr;
+        return copy;
+    }
+
+    template <typename T>
+    static T* shifted(T* p, uint64_t shift) {
+        return p ? reinterpret_cast<T*>(reinterpret_cast<uint8_t*>(p) - shift) : nullptr;
+    }
+
+    // Moves everything reachable from subtree_root to the start of the arena
+    // and rebuilds the transposition table around it. Returns nullptr when
+    // there isn't room for the copy.
+    node* compact(node* subtree_root) {
+        uint64_t shift = a->bytes_used();
+        unordered_map<node*, node*> copies;
+        vector<node*> order = { subtree_root };
+        copies[subtree_root] = copy_node(subtree_root, shift);
+        bool complete = copies[subtree_root];
+        for (size_t i = 0; i < order.size() && complete; i++) {
+            for (edge* e = order[i]->first_edge; e && complete; e = e->next) {
+                if (copies.count(e->child)) continue;
+                node* copy = copy_node(e->child, shift);
+                complete = copy;
+                copies[e->child] = copy;
+                order.push_back(e->child);
+            }
+        }
+        for (size_t i = 0; i < order.size() && complete; i++) {
+            node* copy = copies[order[i]];
+            for (edge* e = order[i]->first_edge; e && complete; e = e->next) {
+                edge* c = reinterpret_cast<edge*>(a->provide_bytes(sizeof(edge)));
+                complete = c;
+                if (!c) break;
+                c->key = e->key;
+                c->child = shifted(copies[e->child], shift);
+                c->next = copy->first_edge;
+                copy->first_edge = shifted(c, shift);
+            }
+        }
+        if (!complete) return nullptr;
+        a->keep_from(shift);
+        table = nullptr;
+        if (use_transpositions) {
+            void* memory = a->provide_bytes(sizeof(transposition_table));
+            if (memory) {
+                table = new (memory) transposition_table(
+                    transposition_table::buckets_for(a->capacity), *a);
+                if (!table->is_valid()) table = nullptr;
+            }
+            for (size_t i = 0; i < order.size() && table; i++) {
+                node* moved = shifted(copies[order[i]], shift);
+                table->store(moved->hash, moved);
+            }
+        }
+        return shifted(copies[subtree_root], shift);
+    }
+
+    // Carries last turn's search forward: finds the child of the root
+    // reached by the moves we played and the position we then observed
+    // (which pins down the opponent's moves) and promotes it to the root.
+    // Returns false when the search has to start again from scratch.
+    bool advance_root(const board<WIDTH>& observed, const moves& played) {
+        current_state = observed;
+        current_state.refresh();
+        node* next = nullptr;
+        if (root) {
+            uint32_t mine = 0;
+            for (uint8_t i = 0; i < 3; i++) {
+                mine |= (uint32_t)action_index(played.actions[i]) << (i * ACTION_BITS);
+            }
+            uint32_t mine_mask = (1 << (3 * ACTION_BITS)) - 1;
+            for (edge* e = root->first_edge; e && !next; e = e->next) {
+                if ((e->key & mine_mask) == mine && e->child->hash == current_state.hash) {
+                    next = e->child;
+                }
+            }
+        }
+        root = next ? compact(next) : nullptr;
+        return root;
+    }
 
+    // Searches until the time budget is spent and returns the most visited
+    // action for each of my worms. A root kept by advance_root is searched
+    // further, otherwise the tree starts from current_state.
+    moves search(chrono::milliseconds budget) {
+        auto start = chrono::steady_clock::now();
+        auto deadline = start + budget;
+        stats = search_stats();
+        if (!root) reset_root();
+        while (chrono::steady_clock::now() < deadline) {
+            simulate_round();
+        }
+        stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return best_moves();
     }
 
 };
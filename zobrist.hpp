@@ -0,0 +1,31 @@
+#ifndef _ZOBRIST_H_
+#define _ZOBRIST_H_
+
+#include <stdint.h>
+
+enum zobrist_feature : uint8_t {
+    DIRT_CELL = 0,
+    AIR_CELL = 1,
+    DEEP_SPACE_CELL = 2,
+    WORM_POSITION = 3,
+    WORM_HEALTH = 4
+};
+
+const int16_t HEALTH_BUCKET_SIZE = 8;
+
+// Keys are derived on demand with splitmix64 rather than read from tables,
+// a few multiplies are cheaper than the cache misses of tables covering
+// every cell for every worm.
+inline uint64_t zobrist_key(zobrist_feature feature, uint8_t slot, uint16_t index) {
+    uint64_t x = 0x9e3779b97f4a7c15ULL *
+        (1 + ((uint64_t)feature << 32 | (uint64_t)slot << 16 | index));
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+inline uint16_t health_bucket(int16_t health) {
+    return health > 0 ? 1 + (health - 1) / HEALTH_BUCKET_SIZE : 0;
+}
+
+#endif